@@ -0,0 +1,55 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// loop heavy benchmark, compare the elapsed time with "uc_superblock" on/off:
+// icpp -p/path/to/runconf.json loop.cc [count]
+
+static unsigned collatz(unsigned long n) {
+  unsigned steps = 0;
+  while (n != 1) {
+    n = n & 1 ? n * 3 + 1 : n / 2;
+    steps++;
+  }
+  return steps;
+}
+
+static unsigned sieve(unsigned limit) {
+  auto flags = new bool[limit + 1]{};
+  unsigned primes = 0;
+  for (unsigned i = 2; i <= limit; i++) {
+    if (flags[i])
+      continue;
+    primes++;
+    for (unsigned j = i * 2; j <= limit; j += i)
+      flags[j] = true;
+  }
+  delete[] flags;
+  return primes;
+}
+
+int main(int argc, const char *argv[]) {
+  unsigned count = 100000;
+  if (argc > 1) {
+    auto usrdef = std::atoi(argv[argc - 1]);
+    if (usrdef > 0)
+      count = usrdef;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  unsigned long total = 0;
+  for (unsigned i = 1; i <= count; i++)
+    total += collatz(i);
+  auto mid = std::chrono::steady_clock::now();
+  auto primes = sieve(count * 10);
+  auto end = std::chrono::steady_clock::now();
+
+  auto ms = [](auto d) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(d).count();
+  };
+  std::printf("collatz(1..%u) steps %lu, %lldms.\n", count, total,
+              static_cast<long long>(ms(mid - start)));
+  std::printf("sieve(%u) primes %u, %lldms.\n", count * 10, primes,
+              static_cast<long long>(ms(end - mid)));
+  return 0;
+}
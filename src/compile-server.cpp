@@ -0,0 +1,388 @@
+/* Interpreting C++, executing the source and executable like a script */
+/* By Jesse Liu < neoliu2011@gmail.com >, 2024 */
+/* Copyright (c) vpand.com 2024. This file is released under LGPL2.
+   See LICENSE in root directory for more details
+*/
+
+#include "compile.h"
+#include "icpp.h"
+#include "object.h"
+#include "runcfg.h"
+#include "utils.h"
+#include <clang/Basic/Diagnostic.h>
+#include <clang/Basic/FileManager.h>
+#include <clang/CodeGen/CodeGenAction.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Frontend/CompilerInvocation.h>
+#include <clang/Frontend/PrecompiledPreamble.h>
+#include <clang/Frontend/Utils.h>
+#include <clang/Lex/PreprocessorOptions.h>
+#include <clang/Serialization/InMemoryModuleCache.h>
+#include <clang/Serialization/PCHContainerOperations.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/BinaryFormat/Magic.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/VirtualFileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/xxhash.h>
+#include <algorithm>
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace icpp {
+
+/*
+in-process compile service of the snippets evaluated by exec_string, e.g.:
+the repl inputs and the icpp::exec_expression calls of the scripts.
+
+the compiler invocation is created only once, the leading #include
+directives of the snippet (e.g.: <icpp.hpp>) are precompiled to an in-memory
+preamble which is reused as long as they are unchanged, the snippet itself is
+compiled from memory to an in-memory object without touching the disk. the
+file manager and module cache live across the compilations like the preamble,
+so the headers outside the preamble aren't looked up again for every snippet.
+*/
+class CompileServer {
+public:
+  CompileServer(const char *argv0);
+
+  bool ready() { return invocation_ != nullptr; }
+
+  // the hash of the snippet source and the compiling flags
+  uint64_t key(std::string_view source);
+
+  // nullptr if failed, the diagnostics have been printed by clang, the
+  // object is loaded from opath if it isn't empty, otherwise from memory
+  std::shared_ptr<Object> compile(std::string_view source,
+                                  const fs::path &opath);
+
+private:
+  void buildPreamble(const llvm::MemoryBuffer &buffer,
+                     clang::PreambleBounds bounds);
+
+  std::mutex mutex_;
+  // the virtual path of the snippet source
+  std::string srcpath_;
+  // the driver args except the output path
+  std::string flags_;
+  llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> vfs_;
+  std::shared_ptr<clang::PCHContainerOperations> pchops_;
+  std::shared_ptr<clang::CompilerInvocation> invocation_;
+  std::unique_ptr<clang::PrecompiledPreamble> preamble_;
+  // bumped whenever the preamble is rebuilt
+  unsigned preamblegen_ = 0;
+  // the file manager is bound to the preamble generation it was created for,
+  // as the vfs overlay of the preamble is different and the headers may have
+  // changed once it's rebuilt
+  llvm::IntrusiveRefCntPtr<clang::FileManager> filemgr_;
+  unsigned filemgrgen_ = 0;
+  llvm::IntrusiveRefCntPtr<clang::InMemoryModuleCache> modcache_;
+};
+
+CompileServer::CompileServer(const char *argv0)
+    : srcpath_((fs::temp_directory_path() / "icpp-snippet.cc").string()),
+      pchops_(std::make_shared<clang::PCHContainerOperations>()),
+      modcache_(llvm::makeIntrusiveRefCnt<clang::InMemoryModuleCache>()) {
+  llvm::InitializeAllTargets();
+  llvm::InitializeAllTargetMCs();
+  llvm::InitializeAllAsmPrinters();
+  llvm::InitializeAllAsmParsers();
+
+  // the snippet only exists in memory, give the driver a placeholder to make
+  // its input checking happy
+  auto memfs = llvm::makeIntrusiveRefCnt<llvm::vfs::InMemoryFileSystem>();
+  memfs->addFile(srcpath_, 0, llvm::MemoryBuffer::getMemBuffer(""));
+  auto overlay = llvm::makeIntrusiveRefCnt<llvm::vfs::OverlayFileSystem>(
+      llvm::vfs::getRealFileSystem());
+  overlay->pushOverlay(memfs);
+  vfs_ = overlay;
+
+  // the same driver args as compiling a snippet source file, the output path
+  // is never written as the object is emitted to memory
+  auto opath =
+      (fs::temp_directory_path() / rand_filename(8, obj_ext)).string();
+  std::vector<const char *> args;
+  args.push_back(argv0);
+  if (RunConfig::repl)
+    args.push_back("-w");
+  args.push_back("-O1");
+  args.push_back("-c");
+  args.push_back(srcpath_.c_str());
+  args.push_back("-o");
+  args.push_back(opath.c_str());
+  auto ccargs = compile_args_icpp(static_cast<int>(args.size()), &args[0]);
+  if (!ccargs.size())
+    return;
+
+  std::vector<const char *> cargs;
+  for (auto &a : ccargs) {
+    cargs.push_back(a.c_str());
+    if (a != opath)
+      flags_ += a + "\n";
+  }
+  flags_ += version_string();
+  clang::CreateInvocationOptions opts;
+  opts.VFS = vfs_;
+  invocation_ = clang::createInvocation(cargs, std::move(opts));
+  if (!invocation_)
+    log_print(Develop, "Failed to create the in-process compiler: {}",
+              llvm::join(ccargs, " "));
+}
+
+void CompileServer::buildPreamble(const llvm::MemoryBuffer &buffer,
+                                  clang::PreambleBounds bounds) {
+  auto diags = clang::CompilerInstance::createDiagnostics(
+      &invocation_->getDiagnosticOpts());
+  clang::PreambleCallbacks callbacks;
+  auto preamble = clang::PrecompiledPreamble::Build(
+      *invocation_, &buffer, bounds, *diags, vfs_, pchops_, true, "",
+      callbacks);
+  if (!preamble) {
+    log_print(Develop, "Failed to build the snippet preamble: {}.",
+              preamble.getError().message());
+    preamble_.reset();
+    return;
+  }
+  preamble_ =
+      std::make_unique<clang::PrecompiledPreamble>(std::move(preamble.get()));
+  preamblegen_++;
+}
+
+uint64_t CompileServer::key(std::string_view source) {
+  auto text = flags_ + "\n" + std::string(source);
+  return llvm::xxh3_64bits(
+      llvm::arrayRefFromStringRef(llvm::StringRef(text.data(), text.size())));
+}
+
+std::shared_ptr<Object> CompileServer::compile(std::string_view source,
+                                               const fs::path &opath) {
+  std::lock_guard lock(mutex_);
+
+  auto buffer = llvm::MemoryBuffer::getMemBufferCopy(
+      llvm::StringRef(source.data(), source.size()), srcpath_);
+  auto invocation = std::make_shared<clang::CompilerInvocation>(*invocation_);
+  auto vfs = vfs_;
+  // reuse or rebuild the precompiled #include directives, generation 0 means
+  // no preamble
+  unsigned gen = 0;
+  auto bounds =
+      clang::ComputePreambleBounds(invocation->getLangOpts(), *buffer, 0);
+  if (bounds.Size) {
+    if (!preamble_ || !preamble_->CanReuse(*invocation, *buffer, bounds, *vfs))
+      buildPreamble(*buffer, bounds);
+    if (preamble_) {
+      preamble_->AddImplicitPreamble(*invocation, vfs, buffer.get());
+      gen = preamblegen_;
+    }
+  }
+  if (!filemgr_ || filemgrgen_ != gen) {
+    filemgr_ = llvm::makeIntrusiveRefCnt<clang::FileManager>(
+        invocation->getFileSystemOpts(), vfs);
+    filemgrgen_ = gen;
+  }
+  auto &ppopts = invocation->getPreprocessorOpts();
+  ppopts.addRemappedFile(srcpath_, buffer.get());
+  ppopts.RetainRemappedFileBuffers = true;
+
+  llvm::SmallVector<char, 0> obuf;
+  clang::CompilerInstance ci(pchops_, modcache_.get());
+  ci.setInvocation(invocation);
+  ci.createDiagnostics();
+  ci.setFileManager(filemgr_.get());
+  ci.setOutputStream(std::make_unique<llvm::raw_svector_ostream>(obuf));
+  clang::EmitObjAction action;
+  if (!ci.ExecuteAction(action) ||
+      ci.getDiagnostics().hasErrorOccurred())
+    return nullptr;
+
+  if (!opath.empty()) {
+    // let the execution engine generate its .io cache beside
+    std::ofstream outf(opath, std::ios::binary);
+    outf.write(obuf.data(), obuf.size());
+    outf.close();
+    bool validcache;
+    auto srcpath = fs::path(opath).replace_extension(".cc").string();
+    return create_object(srcpath, opath.string(), validcache);
+  }
+
+  auto membuf = llvm::MemoryBuffer::getMemBufferCopy(
+      llvm::StringRef(obuf.data(), obuf.size()), srcpath_);
+  using fm = llvm::file_magic;
+  switch (llvm::identify_magic(membuf->getBuffer())) {
+  case fm::macho_object:
+    return std::make_shared<MachOMemoryObject>(srcpath_, std::move(membuf));
+  case fm::elf_relocatable:
+    return std::make_shared<ELFMemoryObject>(srcpath_, std::move(membuf));
+  case fm::coff_object:
+    return std::make_shared<COFFMemoryObject>(srcpath_, std::move(membuf));
+  default:
+    log_print(Runtime, "Unknown object format emitted by the compiler.");
+    return nullptr;
+  }
+}
+
+/*
+cache of the compiled snippet objects keyed by CompileServer::key, the
+repeated evaluations skip compiling, parsing and decoding.
+
+the objects are kept in memory in lru order, an object is taken away while
+it's running and put back to be restored for the next run. if the on disk
+cache is on, the snippets are compiled to the object files in the cache
+directory, their .io caches are generated beside by the execution engine or
+by put in repl where the engine doesn't, they're reused by the later icpp
+processes, and the directory is pruned in lru order
+of the file modification time.
+*/
+class SnippetCache {
+public:
+  SnippetCache();
+
+  // whether the objects are kept in memory to be rerun
+  bool reusable() { return capacity_ != 0; }
+
+  std::shared_ptr<Object> take(uint64_t key);
+  void put(uint64_t key, std::shared_ptr<Object> object, bool reuse);
+
+  // the file path of the snippet in the on disk cache, empty if it's off
+  fs::path diskPath(uint64_t key, std::string_view ext);
+
+private:
+  void prune();
+
+  std::mutex mutex_;
+  size_t capacity_;
+  uint64_t disksize_;
+  fs::path diskroot_;
+  // the most recently used one is at front
+  std::list<std::pair<uint64_t, std::shared_ptr<Object>>> lru_;
+  std::unordered_map<uint64_t, decltype(lru_)::iterator> index_;
+};
+
+SnippetCache::SnippetCache()
+    : capacity_(RunConfig::inst()->snippetCache()),
+      disksize_(RunConfig::inst()->snippetDiskCache()) {
+  if (disksize_)
+    diskroot_ = must_exist(fs::path(home_directory()) / ".icpp/snippet");
+}
+
+fs::path SnippetCache::diskPath(uint64_t key, std::string_view ext) {
+  if (!disksize_)
+    return "";
+  return diskroot_ / std::format("{:016x}{}", key, ext);
+}
+
+std::shared_ptr<Object> SnippetCache::take(uint64_t key) {
+  std::lock_guard lock(mutex_);
+  auto found = index_.find(key);
+  if (found != index_.end()) {
+    auto object = found->second->second;
+    lru_.erase(found->second);
+    index_.erase(found);
+    object->restore();
+    return object;
+  }
+  if (!disksize_)
+    return nullptr;
+
+  std::error_code err;
+  auto iopath = diskPath(key, iobj_ext);
+  if (!fs::exists(iopath, err))
+    return nullptr;
+  bool validcache;
+  auto object = create_object(diskPath(key, ".cc").string(), iopath.string(),
+                              validcache);
+  if (!object || !object->valid()) {
+    fs::remove(iopath, err);
+    return nullptr;
+  }
+  // mark it as the most recently used one
+  fs::last_write_time(iopath, fs::file_time_type::clock::now(), err);
+  log_print(Develop, "Using snippet cache file {}.", iopath.string());
+  if (capacity_)
+    object->snapshot();
+  return object;
+}
+
+void SnippetCache::put(uint64_t key, std::shared_ptr<Object> object,
+                       bool reuse) {
+  std::lock_guard lock(mutex_);
+  if (disksize_) {
+    // the .io cache has been generated by the engine if everything went
+    // well, except in repl
+    if (RunConfig::repl && reuse && !object->isCache() && object->cacheable())
+      object->generateCache();
+    std::error_code err;
+    fs::remove(diskPath(key, obj_ext), err);
+    prune();
+    // the reruns mustn't regenerate it from the removed object file
+    if (!object->isCache())
+      object->disableCache();
+  }
+  if (!reuse || !capacity_ || index_.contains(key))
+    return;
+  lru_.emplace_front(key, object);
+  index_[key] = lru_.begin();
+  if (lru_.size() > capacity_) {
+    index_.erase(lru_.back().first);
+    lru_.pop_back();
+  }
+}
+
+void SnippetCache::prune() {
+  std::vector<std::tuple<fs::file_time_type, uint64_t, fs::path>> files;
+  uint64_t total = 0;
+  std::error_code err;
+  for (auto &entry : fs::directory_iterator(diskroot_, err)) {
+    if (entry.path().extension() != iobj_ext)
+      continue;
+    auto size = entry.file_size(err);
+    auto time = entry.last_write_time(err);
+    if (err)
+      continue;
+    files.push_back({time, size, entry.path()});
+    total += size;
+  }
+  if (total <= disksize_)
+    return;
+  // remove the least recently used ones
+  std::sort(files.begin(), files.end());
+  for (auto &f : files) {
+    if (total <= disksize_)
+      break;
+    fs::remove(std::get<2>(f), err);
+    total -= std::get<1>(f);
+  }
+}
+
+static SnippetCache &snippet_cache() {
+  static SnippetCache cache;
+  return cache;
+}
+
+bool compile_snippet(const char *argv0, std::string_view source,
+                     std::shared_ptr<Object> &object, uint64_t &key) {
+  static CompileServer server(argv0);
+  if (!server.ready())
+    return false;
+
+  auto &cache = snippet_cache();
+  key = server.key(source);
+  object = cache.take(key);
+  if (object)
+    return true;
+  object = server.compile(source, cache.diskPath(key, obj_ext));
+  if (object && object->valid() && cache.reusable())
+    object->snapshot();
+  return true;
+}
+
+void cache_snippet(uint64_t key, std::shared_ptr<Object> object,
+                   bool reuse) {
+  snippet_cache().put(key, object, reuse);
+}
+
+} // namespace icpp
@@ -6,13 +6,18 @@
 
 #include "compile.h"
 #include "arch.h"
+#include "icpp.h"
 #include "object.h"
 #include "platform.h"
 #include "runcfg.h"
 #include "runtime.h"
 #include "utils.h"
 #include <atomic>
+#include <cctype>
 #include <fstream>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/xxhash.h>
 #include <optional>
 #include <vector>
 
@@ -34,13 +39,7 @@ static std::string argv_string(int argc, const char **argv) {
   return cmds;
 }
 
-int compile_source_clang(int argc, const char **argv, bool cl) {
-  // just echo the compiling args
-  if (echocc) {
-    echocc = false;
-    log_print(Develop, "{}", argv_string(argc, argv));
-    return 0;
-  }
+static std::string clang_program(int argc, const char **argv, bool cl) {
   if (!cl) {
     for (int i = 0; i < argc; i++) {
       if (std::string_view(argv[i]).starts_with("/clang")) {
@@ -56,9 +55,19 @@ int compile_source_clang(int argc, const char **argv, bool cl) {
   auto exepath = GetExecutablePath(argv[0], true);
   // this full path ends with "clang", it's exactly the format that clang driver
   // wants
-  auto program = (fs::path(exepath).parent_path() / ".." / "lib" /
-                  (cl ? "clang-cl" : "clang"))
-                     .string();
+  return (fs::path(exepath).parent_path() / ".." / "lib" /
+          (cl ? "clang-cl" : "clang"))
+      .string();
+}
+
+int compile_source_clang(int argc, const char **argv, bool cl) {
+  // just echo the compiling args
+  if (echocc) {
+    echocc = false;
+    log_print(Develop, "{}", argv_string(argc, argv));
+    return 0;
+  }
+  auto program = clang_program(argc, argv, cl);
   auto argv0 = argv[0];
   argv[0] = program.c_str();
   // iclang_main will invoke clang_main to generate the object file with the
@@ -71,7 +80,10 @@ int compile_source_clang(int argc, const char **argv, bool cl) {
   return result;
 }
 
-int compile_source_icpp(int argc, const char **argv) {
+// complete the args with the icpp runtime flags and pass them to driver
+static int icpp_driver_args(
+    int argc, const char **argv,
+    const std::function<int(int argc, const char **argv, bool cl)> &driver) {
   auto root = fs::absolute(fs::path(argv[0])).parent_path() / "..";
   auto rtinc = (root / "include").string();
   bool cross_compile = false, cl = false, cppsrc = true;
@@ -240,7 +252,181 @@ int compile_source_icpp(int argc, const char **argv) {
     args.push_back(modincs.rbegin()->data());
   }
 
-  return compile_source_clang(static_cast<int>(args.size()), &args[0], cl);
+  return driver(static_cast<int>(args.size()), &args[0], cl);
+}
+
+int compile_source_icpp(int argc, const char **argv) {
+  return icpp_driver_args(argc, argv, compile_source_clang);
+}
+
+static uint64_t content_hash(std::string_view data) {
+  return llvm::xxh3_64bits(llvm::arrayRefFromStringRef(
+      llvm::StringRef(data.data(), data.size())));
+}
+
+static std::optional<uint64_t> file_hash(const std::string &path) {
+  auto expBuff = llvm::MemoryBuffer::getFile(path);
+  if (!expBuff)
+    return std::nullopt;
+  auto buff = expBuff.get()->getBuffer();
+  return content_hash({buff.data(), buff.size()});
+}
+
+// the source must be recompiled if any of these changes, the user include
+// directories and the installed modules affect how the headers are resolved
+static uint64_t flags_hash(const char *opt,
+                           const std::vector<const char *> &incdirs) {
+  auto flags =
+      std::format("{}\n{}\n{}\n", version_string(), main_program(), opt);
+  for (auto i : incdirs)
+    flags += std::format("{}\n", i);
+  for (auto &m : RuntimeLib::inst().modules())
+    flags += std::format("{}\n", m);
+  return content_hash(flags);
+}
+
+// parse the make style dependency file generated by clang, the first one is
+// the source itself and the others are the headers it includes
+static std::vector<std::string> parse_depfile(const std::string &dpath) {
+  std::vector<std::string> deps;
+  auto expBuff = llvm::MemoryBuffer::getFile(dpath);
+  if (!expBuff)
+    return deps;
+  auto text = expBuff.get()->getBuffer();
+  // skip the target, a windows drive letter colon isn't followed by space
+  auto colon = text.find(": ");
+  if (colon == llvm::StringRef::npos)
+    return deps;
+
+  std::string dep;
+  for (size_t i = colon + 2; i < text.size(); i++) {
+    char c = text[i];
+    if (c == '\\' && i + 1 < text.size()) {
+      char next = text[i + 1];
+      if (next == ' ' || next == '#') {
+        // escaped character in path
+        dep.push_back(next);
+        i++;
+        continue;
+      }
+      if (next == '\n' || next == '\r')
+        c = ' '; // line continuation
+    } else if (c == '$' && i + 1 < text.size() && text[i + 1] == '$') {
+      dep.push_back(c);
+      i++;
+      continue;
+    }
+    if (std::isspace(static_cast<unsigned char>(c))) {
+      if (dep.size())
+        deps.push_back(fs::absolute(dep).string());
+      dep.clear();
+      continue;
+    }
+    dep.push_back(c);
+  }
+  if (dep.size())
+    deps.push_back(fs::absolute(dep).string());
+  return deps;
+}
+
+// generate the dependency manifest of the compiled object, it'll be embedded
+// into the .io file when caching the object
+static void generate_manifest(const std::string &dpath,
+                              const std::string &opath, uint64_t flags) {
+  auto deps = parse_depfile(dpath);
+  if (!deps.size()) {
+    log_print(Develop, "Failed to parse the dependency file {}.", dpath);
+    return;
+  }
+
+  std::string manifest(sizeof(IObjManifest), 0);
+  std::string hashes(reinterpret_cast<const char *>(&flags), sizeof(flags));
+  for (auto &d : deps) {
+    std::error_code serr, terr;
+    auto size = fs::file_size(d, serr);
+    auto mtime = fs::last_write_time(d, terr);
+    auto hash = file_hash(d);
+    if (serr || terr || !hash) {
+      log_print(Develop, "Failed to stat the dependency {}.", d);
+      return;
+    }
+    IObjDepend idep{size,
+                    static_cast<int64_t>(mtime.time_since_epoch().count()),
+                    hash.value(), static_cast<uint32_t>(d.size()), 0};
+    manifest.append(reinterpret_cast<const char *>(&idep), sizeof(idep));
+    manifest.append(d);
+    manifest.resize((manifest.size() + 7) & ~7);
+    hashes.append(reinterpret_cast<const char *>(&idep.hash),
+                  sizeof(idep.hash));
+  }
+  auto header = reinterpret_cast<IObjManifest *>(&manifest[0]);
+  header->key = content_hash(hashes);
+  header->flags = flags;
+  header->count = static_cast<uint32_t>(deps.size());
+
+  std::ofstream outf(fs::path(opath).replace_extension(imf_ext),
+                     std::ios::binary);
+  outf.write(manifest.data(), manifest.size());
+}
+
+// check whether the dependencies recorded in the manifest are unchanged,
+// the size and mtime are compared first and the content is only hashed if
+// the file has been touched, the recorded hashes must match the manifest key
+static bool check_manifest(std::string_view manifest, uint64_t flags) {
+  if (manifest.size() < sizeof(IObjManifest))
+    return false;
+  auto header = reinterpret_cast<const IObjManifest *>(manifest.data());
+  if (header->flags != flags || !header->count)
+    return false;
+
+  std::string hashes(reinterpret_cast<const char *>(&flags), sizeof(flags));
+  size_t offset = sizeof(IObjManifest);
+  for (uint32_t i = 0; i < header->count; i++) {
+    if (sizeof(IObjDepend) > manifest.size() - offset)
+      return false;
+    auto dep = reinterpret_cast<const IObjDepend *>(&manifest[offset]);
+    offset += sizeof(IObjDepend);
+    if (dep->pathsize > manifest.size() - offset)
+      return false;
+    std::string path(&manifest[offset], dep->pathsize);
+    offset = std::min<size_t>((offset + dep->pathsize + 7) & ~7,
+                              manifest.size());
+    hashes.append(reinterpret_cast<const char *>(&dep->hash),
+                  sizeof(dep->hash));
+
+    std::error_code err;
+    auto size = fs::file_size(path, err);
+    if (err || size != dep->size) {
+      log_print(Develop, "Dependency {} has been changed.", path);
+      return false;
+    }
+    auto mtime = fs::last_write_time(path, err);
+    if (!err && mtime.time_since_epoch().count() == dep->mtime)
+      continue;
+    // touched, compare the content
+    auto hash = file_hash(path);
+    if (!hash || hash.value() != dep->hash) {
+      log_print(Develop, "Dependency {} has been changed.", path);
+      return false;
+    }
+  }
+  if (content_hash(hashes) != header->key) {
+    log_print(Develop, "The dependency manifest is corrupted.");
+    return false;
+  }
+  return true;
+}
+
+// the .io cache file of the source if it's still up to date
+static fs::path cache_file(std::string_view path, uint64_t flags) {
+  auto srcpath = fs::path(path);
+  auto cachepath = fs::absolute(srcpath.parent_path()) /
+                   (srcpath.stem().string() + iobj_ext.data());
+  if (!fs::exists(cachepath))
+    return "";
+  if (!check_manifest(iobj_manifest(cachepath.string()), flags))
+    return "";
+  return cachepath;
 }
 
 fs::path compile_source_icpp(const char *argv0, std::string_view path,
@@ -273,19 +459,57 @@ fs::path compile_source_icpp(const char *argv0, std::string_view path,
     args.push_back(i);
   }
 
-  // using the cache file if there exists one
-  auto cache = convert_file(path, iobj_ext);
+  // using the cache file if its source, headers and compiling flags are all
+  // unchanged
+  auto flags = flags_hash(opt, incdirs);
+  auto cache = cache_file(path, flags);
+  auto dpath = fs::path(opath).replace_extension(".d").string();
+#if ON_WINDOWS
+  auto dfarg = "/clang:-MF" + dpath;
+#endif
   if (cache.has_filename()) {
     log_print(Develop, "Using iobject cache file when compiling: {}.",
               cache.string());
     // print the current compiling args
     echocc = true;
+  } else {
+    // let clang output the included headers
+#if ON_WINDOWS
+    args.push_back("/clang:-MD");
+    args.push_back(dfarg.c_str());
+#else
+    args.push_back("-MD");
+    args.push_back("-MF");
+    args.push_back(dpath.c_str());
+#endif
   }
 
-  compile_source_icpp(static_cast<int>(args.size()), &args[0]);
+  if (!compile_source_icpp(static_cast<int>(args.size()), &args[0]) &&
+      !cache.has_filename()) {
+    generate_manifest(dpath, opath, flags);
+  }
+  if (fs::exists(dpath))
+    fs::remove(dpath);
   return cache.has_filename() ? cache : fs::path(opath);
 }
 
+std::vector<std::string> compile_args_icpp(int argc, const char **argv) {
+  std::vector<std::string> args;
+  icpp_driver_args(argc, argv, [&args](int argc, const char **argv, bool cl) {
+    args.assign(argv, argv + argc);
+    args.front() = clang_program(argc, argv, cl);
+    return 0;
+  });
+  return args;
+}
+
+void remove_object(const fs::path &opath) {
+  fs::remove(opath);
+  auto mfpath = fs::path(opath).replace_extension(imf_ext);
+  if (fs::exists(mfpath))
+    fs::remove(mfpath);
+}
+
 static void precompile_module(const char *argv0, const fs::path &root,
                               const fs::path pcmroot, const fs::path &cppm) {
   must_exist(pcmroot);
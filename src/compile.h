@@ -7,19 +7,40 @@
 #pragma once
 
 #include "utils.h"
+#include <memory>
 
 namespace icpp {
 
+class Object;
+
 int cformat_main(int argc, const char **argv);
 
 int compile_source_clang(int argc, const char **argv, bool cl = false);
 
 int compile_source_icpp(int argc, const char **argv);
 
+// the full clang driver args that compile_source_icpp would run with
+std::vector<std::string> compile_args_icpp(int argc, const char **argv);
+
 fs::path compile_source_icpp(const char *argv0, std::string_view path,
                              const char *opt,
                              const std::vector<const char *> &incdirs);
 
+// remove the temporary object file compiled from source and its dependency
+// manifest
+void remove_object(const fs::path &opath);
+
+// compile the source snippet in memory with the warm in-process compiler or
+// take its compiled object from the snippet cache, object is nullptr if clang
+// failed and has printed the errors, it returns false if the in-process
+// compiler isn't available
+bool compile_snippet(const char *argv0, std::string_view source,
+                     std::shared_ptr<Object> &object, uint64_t &key);
+
+// give back the executed snippet object to the snippet cache, reuse is false
+// if it didn't run successfully
+void cache_snippet(uint64_t key, std::shared_ptr<Object> object, bool reuse);
+
 void precompile_module(const char *argv0);
 
 } // namespace icpp
@@ -15,12 +15,7 @@ namespace icpp {
 
 static void send_buffer(ip::tcp::socket *s, icppdbg::CommandID id,
                         const std::string_view &respbuf) {
-  std::string buff;
-  buff.resize(sizeof(icpp::ProtocolHdr) + respbuf.length());
-  auto hdr = reinterpret_cast<icpp::ProtocolHdr *>(buff.data());
-  hdr->cmd = id;
-  hdr->len = static_cast<uint32_t>(respbuf.length());
-  std::memcpy(&hdr[1], respbuf.data(), respbuf.length());
+  auto buff = icpp::protocol_frame(id, respbuf);
 
   boost::system::error_code error;
   asio::write(*s, asio::buffer(buff), error);
@@ -265,9 +260,22 @@ void Debugger::recv(ip::tcp::socket *socket) {
       process(hdr, "", 0);
       continue;
     }
+    uint64_t bodylen;
+    if (!icpp::protocol_body_length(
+            hdr,
+            [&](void *buff, size_t size) {
+              asio::read(*socket, asio::buffer(buff, size), error);
+              return !error;
+            },
+            bodylen)) {
+      // either failed to read it or it exceeds the limit
+      log_print(Develop, "Invalid body length of cmd.{}.\nClosed connection.",
+                hdr->cmd);
+      break;
+    }
     // protocol body serialized by protobuf
     asio::streambuf probuffer;
-    asio::read(*socket, probuffer, asio::transfer_exactly(hdr->len), error);
+    asio::read(*socket, probuffer, asio::transfer_exactly(bodylen), error);
     if (error && error != asio::error::eof) {
       log_print(Develop, "Failed to read body buffer: {}.", error.message());
       continue;
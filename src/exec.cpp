@@ -10,14 +10,18 @@
 #include "loader.h"
 #include "object.h"
 #include "platform.h"
+#include "profile.h"
 #include "runcfg.h"
+#include "trace.h"
 #include "utils.h"
 
 #include <csetjmp>
 #include <llvm/ADT/Twine.h>
 #include <llvm/BinaryFormat/Magic.h>
 #include <llvm/Support/Signals.h>
+#include <atomic>
 #include <mutex>
+#include <thread>
 #include <unicorn/unicorn.h>
 
 #define LOG_EXECUTION 0
@@ -28,44 +32,83 @@
 
 namespace icpp {
 
+// vector register counts exchanged between unicorn and host context:
+// all: the vector registers host_call_asm/host_context switches
+// arg/ret: the argument/return vector registers of the host calling
+//          convention, the others are either callee saved or scratch ones,
+//          so a host call needn't transfer them
+constexpr const int a64_vecs_all = 32, a64_vecs_arg = 8, a64_vecs_ret = 4;
+constexpr const int x64_vecs_all = 16, x64_vecs_arg = 8, x64_vecs_ret = 4;
+
 // uc instance cache
 struct UnicornEngine {
   uc_engine *acquire(Object *object) {
-    std::lock_guard lock(mutex);
-    uc_engine *uc;
-    if (free.size()) {
-      // get a free cache uc
-      uc = *free.begin();
-      free.erase(free.begin());
-    } else {
-      // there's no available cache uc, create a new one
-      auto err = uc_open(arch(object), mode(object), &uc);
-      if (err != UC_ERR_OK) {
-        std::cout << "Failed to create unicorn engine instance: "
-                  << uc_strerror(err) << std::endl;
-        std::exit(-1);
+    busy++;
+    if (!started.exchange(true)) {
+      // create the warm instances in background
+      auto count = RunConfig::inst()->ucPoolWarm();
+      if (count > 0) {
+        warmer = std::thread([this, count, ucarch = arch(object),
+                              ucmode = mode(object)]() {
+          for (int i = 0; i < count; i++) {
+            auto uc = create(ucarch, ucmode);
+            if (!push(uc)) {
+              uc_close(uc);
+              break;
+            }
+            warms++;
+          }
+        });
       }
-#if __x86_64__
-      // make sure the dr7 contains 0, as we'll reuse it as a zero register,
-      // this situation will occur when the llvm MCInst contains an EIZ/RIZ
-      // register
-      uint64_t zero = 0;
-      uc_reg_write(uc, UC_X86_REG_DR7, &zero);
-#else
-      // use the max version of arm64 cpu
-      uc_ctl_set_cpu_model(uc, UC_CPU_ARM64_MAX);
-#endif
     }
-    busy.insert(uc);
-    return uc;
+    // prefer the instance released by this thread last time
+    auto uc = std::exchange(local.uc, nullptr);
+    if (!uc)
+      uc = pop();
+    if (uc) {
+      hits++;
+      return uc;
+    }
+    // there's no available cache uc, create a new one
+    misses++;
+    return create(arch(object), mode(object));
   }
 
   void release(uc_engine *uc) {
-    std::lock_guard lock(mutex);
-    // save to free list
-    free.insert(uc);
-    // remove from busy list
-    busy.erase(busy.find(uc));
+    busy--;
+    // keep it for the next engine of this thread
+    if (!local.uc) {
+      local.uc = uc;
+      return;
+    }
+    recycle(uc);
+  }
+
+  // save to free list, close it if the pool is full
+  void recycle(uc_engine *uc) {
+    if (!push(uc))
+      uc_close(uc);
+  }
+
+  static uc_engine *create(uc_arch arch, uc_mode mode) {
+    uc_engine *uc;
+    auto err = uc_open(arch, mode, &uc);
+    if (err != UC_ERR_OK) {
+      std::cout << "Failed to create unicorn engine instance: "
+                << uc_strerror(err) << std::endl;
+      std::exit(-1);
+    }
+#if __x86_64__
+    // make sure the dr7 contains 0, as we'll reuse it as a zero register,
+    // this situation will occur when the llvm MCInst contains an EIZ/RIZ
+    // register
+    uint64_t zero = 0;
+    uc_reg_write(uc, UC_X86_REG_DR7, &zero);
+#else
+    // use the max version of arm64 cpu
+    uc_ctl_set_cpu_model(uc, UC_CPU_ARM64_MAX);
+#endif
+    return uc;
   }
 
   static uc_arch arch(Object *object) {
@@ -89,14 +132,20 @@ struct UnicornEngine {
   }
 
   ~UnicornEngine() {
+    if (warmer.joinable())
+      warmer.join();
     // release all cached uc instance
-    for (auto uc : free)
-      uc_close(uc);
-    for (auto uc : busy)
-      log_print(
-          Develop,
-          "Virtual CPU instance {} is still running while exiting program.",
-          reinterpret_cast<void *>(uc));
+    for (auto &slot : free) {
+      if (auto uc = slot.exchange(nullptr))
+        uc_close(uc);
+    }
+    if (busy)
+      log_print(Develop,
+                "There're still {} virtual CPU instances running while "
+                "exiting program.",
+                busy.load());
+    log_print(Develop, "Virtual CPU pool statistics: hit={}, miss={}, warm={}.",
+              hits.load(), misses.load(), warms.load());
   }
 
   int parentRegisterAArch64(int reg) {
@@ -152,14 +201,53 @@ struct UnicornEngine {
   }
 
 private:
-  // available uc instance
-  std::set<uc_engine *> free;
-  // uc instance used by some thread
-  std::set<uc_engine *> busy;
+  // lock-free free list operations, each slot holds one free uc instance
+  bool push(uc_engine *uc) {
+    int limit =
+        std::min<int>(RunConfig::inst()->ucPoolSize(), std::size(free));
+    for (int i = 0; i < limit; i++) {
+      uc_engine *empty = nullptr;
+      if (free[i].compare_exchange_strong(empty, uc))
+        return true;
+    }
+    return false;
+  }
 
-  std::mutex mutex;
+  uc_engine *pop() {
+    for (auto &slot : free) {
+      if (slot.load(std::memory_order_relaxed)) {
+        if (auto uc = slot.exchange(nullptr))
+          return uc;
+      }
+    }
+    return nullptr;
+  }
+
+  // the uc instance cached by the current thread
+  struct LocalEngine {
+    ~LocalEngine();
+    uc_engine *uc = nullptr;
+  };
+  static thread_local LocalEngine local;
+
+  // available uc instance
+  std::atomic<uc_engine *> free[256]{};
+  // uc instance count used by some thread
+  std::atomic<int> busy = 0;
+  // pool statistics
+  std::atomic<uint64_t> hits = 0, misses = 0, warms = 0;
+  // warm instance creator
+  std::atomic<bool> started = false;
+  std::thread warmer;
 } ue;
 
+thread_local UnicornEngine::LocalEngine UnicornEngine::local;
+
+UnicornEngine::LocalEngine::~LocalEngine() {
+  if (uc)
+    ue.recycle(uc);
+}
+
 struct ExecEngine {
   // clone a new execute engine for thread function
   ExecEngine(ExecEngine &exec)
@@ -184,6 +272,10 @@ struct ExecEngine {
 
     // execute destructor in iobject file
     execDtor();
+    // symbolize the samples while the sampled objects are still alive, the
+    // profiler writes them out once at exit
+    if (profiler_)
+      profiler_->collect();
     // give back the borrowed uc instance
     ue.release(uc_);
 
@@ -228,22 +320,36 @@ private:
   // e.g.: thread create, system api callback, etc.
   // if target is kind of abort, exit or throw, the retaddr will be modified to
   // stop interpreting
-  bool specialCallProcess(uint64_t &target, uint64_t &retaddr);
+  bool specialCallProcess(uint64_t &target, uint64_t &retaddr,
+                          uint32_t ctype = RCALL_UNKNOWN);
+
+  // replace the script function arguments with host callable stubs
+  void stubCallbackArguments(uint64_t *args, size_t count);
+
+  // call the host function, the profiler samples and tracer records are
+  // taken if enabled
+  void hostCall(void *context, uint64_t target, uint64_t retaddr);
+
+  // take a profiler sample of the current pc and its callers,
+  // host is the host function target if it's non-zero
+  void profileSample(uint64_t pc, uint64_t host = 0);
 
   /*
   helper routines for aarch64
   */
   bool interpretCallAArch64(const InsnInfo *&inst, uint64_t &pc,
-                            uint64_t target);
+                            uint64_t target, uint32_t ctype = RCALL_UNKNOWN);
   bool interpretJumpAArch64(const InsnInfo *&inst, uint64_t &pc,
-                            uint64_t target);
+                            uint64_t target, uint32_t ctype = RCALL_UNKNOWN);
   void interpretPCLdrAArch64(const InsnInfo *&inst, uint64_t &pc);
 
   /*
   helper routines for x86_64
   */
-  bool interpretCallX64(const InsnInfo *&inst, uint64_t &pc, uint64_t target);
-  bool interpretJumpX64(const InsnInfo *&inst, uint64_t &pc, uint64_t target);
+  bool interpretCallX64(const InsnInfo *&inst, uint64_t &pc, uint64_t target,
+                        uint32_t ctype = RCALL_UNKNOWN);
+  bool interpretJumpX64(const InsnInfo *&inst, uint64_t &pc, uint64_t target,
+                        uint32_t ctype = RCALL_UNKNOWN);
   uint64_t interpretCalcMemX64(const InsnInfo *&inst, uint64_t &pc, int memop,
                                const uint16_t **opsptr = nullptr);
   template <typename T>
@@ -276,10 +382,10 @@ private:
   /*
   helper routines for unicorn and host register context switch
   */
-  ContextA64 loadRegisterAArch64();
-  void saveRegisterAArch64(const ContextA64 &ctx);
-  ContextX64 loadRegisterX64();
-  void saveRegisterX64(const ContextX64 &ctx);
+  ContextA64 loadRegisterAArch64(int vecs = a64_vecs_all);
+  void saveRegisterAArch64(const ContextA64 &ctx, int vecs = a64_vecs_all);
+  ContextX64 loadRegisterX64(int vecs = x64_vecs_all);
+  void saveRegisterX64(const ContextX64 &ctx, int vecs = x64_vecs_all);
 
   char *topStack() {
     return reinterpret_cast<char *>(stack_.data()) +
@@ -290,6 +396,21 @@ private:
     return topreturn_ ? topreturn_ : static_cast<void *>(this);
   }
 
+  // whether the instruction should be interpreted in the current mode
+  bool interpretable(const InsnInfo *inst) {
+    return superblock_ ? robject_->superblockExit(inst) : !can_emulate(inst);
+  }
+
+  // get the instruction information of the branch destination pc
+  const InsnInfo *insnInfo(uint64_t pc) {
+    auto &bc = brcaches_[(pc ^ (pc >> 10)) % std::size(brcaches_)];
+    if (bc.pc != pc) {
+      bc.inst = robject_->insnInfo(pc);
+      bc.pc = pc;
+    }
+    return bc.inst;
+  }
+
   // create a new stub function for the target
   uint64_t createStub(uint64_t vmfunc);
 
@@ -360,6 +481,24 @@ private:
   std::map<uint64_t, uint64_t> stubvms_;
   void *topreturn_ = nullptr; // return address when called from stub
 
+  // whether in superblock mode, see RunConfig::superblock
+  bool superblock_ = false;
+  // the object whose superblock exits have been set to uc_
+  Object *exitobj_ = nullptr;
+
+  // sampling profiler, nullptr if it's off
+  Profiler *profiler_ = nullptr;
+  // the profiler tick when the last sample was taken
+  uint64_t proftick_ = 0;
+  // execution tracer, nullptr if it's off
+  Tracer *tracer_ = nullptr;
+
+  // <pc, inst> caches of the recently jumped or called destinations
+  struct BranchCache {
+    uint64_t pc;
+    const InsnInfo *inst;
+  } brcaches_[256]{};
+
 #if WIN_ARM64
   char *wintls_ = nullptr;
 #endif
@@ -435,18 +574,41 @@ void ExecEngine::init() {
   robject_ = iobject_.get();
   // get a unicorn instruction emulation instance
   uc_ = ue.acquire(robject_);
-
-  // set the initial register context copied from host
-  ContextICPP initctx;
-  host_context(&initctx);
+  superblock_ = RunConfig::inst()->superblock();
+  if (superblock_)
+    uc_ctl_exits_enable(uc_);
+  profiler_ = Profiler::inst();
+  if (profiler_)
+    proftick_ = profiler_->tick();
+  tracer_ = Tracer::inst();
+
+  // set the initial register context copied from host, a clone starts at a
+  // thread entry whose argument, stack and return registers are all set by
+  // initMainRegister, so it starts from a zeroed context rather than copying
+  // the host one or inheriting the one left by the last user of this uc
+  ContextICPP initctx{};
+  if (!clone_)
+    host_context(&initctx);
 #if ARCH_ARM64
   saveRegisterAArch64(initctx);
 #if WIN_ARM64
-  wintls_ = reinterpret_cast<char *>(initctx.r[18]);
+  // the teb of this thread is needed by the tls epoch simulation
+  ContextICPP hostctx;
+  host_context(&hostctx);
+  wintls_ = reinterpret_cast<char *>(hostctx.r[18]);
 #endif
 #else
   saveRegisterX64(initctx);
 #endif
+  if (clone_) {
+    uint64_t flags = 0;
+#if ARCH_ARM64
+    uc_reg_write(uc_, UC_ARM64_REG_NZCV, &flags);
+#else
+    flags = 0x2; // the reserved bit 1 is always set
+    uc_reg_write(uc_, UC_X86_REG_RFLAGS, &flags);
+#endif
+  }
 
   if (RunConfig::inst()->hasDebugger()) {
     // initialize debugger instance
@@ -591,86 +753,97 @@ bool ExecEngine::run(uint64_t vm, uint64_t arg0, uint64_t arg1) {
   } catch (...) {
     log_print(Runtime, "Exception ocurred, unknown type.");
   }
+  if (tracer_) {
+    uint64_t pc;
+    uc_reg_read(uc_,
+                robject_->arch() == AArch64 ? UC_ARM64_REG_PC : UC_X86_REG_RIP,
+                &pc);
+    tracer_->record(TRACE_EXCEPTION, robject_, pc);
+  }
   dump();
   return false;
 }
 
-ContextA64 ExecEngine::loadRegisterAArch64() {
-  ContextA64 ctx;
-  for (int i = 0; i <= 28; i++) {
-    uc_reg_read(uc_, UC_ARM64_REG_X0 + i, &ctx.r[i]);
+// collect the unicorn register ids and their context slots for a batch
+// reading or writing
+static int context_registers(ContextA64 &ctx, int vecs, int *ids,
+                             void **vals) {
+  int count = 0;
+  for (int i = 0; i <= 28; i++, count++) {
+    ids[count] = UC_ARM64_REG_X0 + i;
+    vals[count] = &ctx.r[i];
   }
-  uc_reg_read(uc_, UC_ARM64_REG_X29, &ctx.r[A64_FP]);
-  uc_reg_read(uc_, UC_ARM64_REG_X30, &ctx.r[A64_LR]);
-  uc_reg_read(uc_, UC_ARM64_REG_SP, &ctx.r[A64_SP]);
-  for (int i = 0; i < 32; i++) {
-    uc_reg_read(uc_, UC_ARM64_REG_V0 + i, &ctx.v[i]);
+  ids[count] = UC_ARM64_REG_X29;
+  vals[count++] = &ctx.r[A64_FP];
+  ids[count] = UC_ARM64_REG_X30;
+  vals[count++] = &ctx.r[A64_LR];
+  ids[count] = UC_ARM64_REG_SP;
+  vals[count++] = &ctx.r[A64_SP];
+  for (int i = 0; i < vecs; i++, count++) {
+    ids[count] = UC_ARM64_REG_V0 + i;
+    vals[count] = &ctx.v[i];
   }
-  return ctx;
+  return count;
 }
 
-void ExecEngine::saveRegisterAArch64(const ContextA64 &ctx) {
-  for (int i = 0; i <= 28; i++) {
-    uc_reg_write(uc_, UC_ARM64_REG_X0 + i, &ctx.r[i]);
+static int context_registers(ContextX64 &ctx, int vecs, int *ids,
+                             void **vals) {
+  std::pair<int, uint64_t *> gprs[] = {
+      {UC_X86_REG_RSP, &ctx.rsp}, {UC_X86_REG_RBP, &ctx.rbp},
+      {UC_X86_REG_RAX, &ctx.rax}, {UC_X86_REG_RBX, &ctx.rbx},
+      {UC_X86_REG_RCX, &ctx.rcx}, {UC_X86_REG_RDX, &ctx.rdx},
+      {UC_X86_REG_RSI, &ctx.rsi}, {UC_X86_REG_RDI, &ctx.rdi},
+      {UC_X86_REG_R8, &ctx.r8},   {UC_X86_REG_R9, &ctx.r9},
+      {UC_X86_REG_R10, &ctx.r10}, {UC_X86_REG_R11, &ctx.r11},
+      {UC_X86_REG_R12, &ctx.r12}, {UC_X86_REG_R13, &ctx.r13},
+      {UC_X86_REG_R14, &ctx.r14}, {UC_X86_REG_R15, &ctx.r15},
+  };
+  int count = 0;
+  for (auto &r : gprs) {
+    ids[count] = r.first;
+    vals[count++] = r.second;
   }
-  uc_reg_write(uc_, UC_ARM64_REG_X29, &ctx.r[A64_FP]);
-  uc_reg_write(uc_, UC_ARM64_REG_X30, &ctx.r[A64_LR]);
-  uc_reg_write(uc_, UC_ARM64_REG_SP, &ctx.r[A64_SP]);
-  for (int i = 0; i < 32; i++) {
-    uc_reg_write(uc_, UC_ARM64_REG_V0 + i, &ctx.v[i]);
+  for (int i = 0; i < vecs; i++, count++) {
+    ids[count] = UC_X86_REG_XMM0 + i;
+    vals[count] = &ctx.xmm[i];
   }
+  return count;
 }
 
-ContextX64 ExecEngine::loadRegisterX64() {
-  ContextX64 ctx;
-  uc_reg_read(uc_, UC_X86_REG_RSP, &ctx.rsp);
-  uc_reg_read(uc_, UC_X86_REG_RBP, &ctx.rbp);
-  uc_reg_read(uc_, UC_X86_REG_RAX, &ctx.rax);
-  uc_reg_read(uc_, UC_X86_REG_RBX, &ctx.rbx);
-  uc_reg_read(uc_, UC_X86_REG_RCX, &ctx.rcx);
-  uc_reg_read(uc_, UC_X86_REG_RDX, &ctx.rdx);
-  uc_reg_read(uc_, UC_X86_REG_RSI, &ctx.rsi);
-  uc_reg_read(uc_, UC_X86_REG_RDI, &ctx.rdi);
-  uc_reg_read(uc_, UC_X86_REG_R8, &ctx.r8);
-  uc_reg_read(uc_, UC_X86_REG_R9, &ctx.r9);
-  uc_reg_read(uc_, UC_X86_REG_R10, &ctx.r10);
-  uc_reg_read(uc_, UC_X86_REG_R11, &ctx.r11);
-  uc_reg_read(uc_, UC_X86_REG_R12, &ctx.r12);
-  uc_reg_read(uc_, UC_X86_REG_R13, &ctx.r13);
-  uc_reg_read(uc_, UC_X86_REG_R14, &ctx.r14);
-  uc_reg_read(uc_, UC_X86_REG_R15, &ctx.r15);
-  for (int i = 0; i < 8; i++) {
-    uc_reg_read(uc_, UC_X86_REG_ST0 + i, &ctx.stmmx[i]);
-  }
-  for (int i = 0; i < 32; i++) {
-    uc_reg_read(uc_, UC_X86_REG_XMM0, &ctx.xmm[i]);
-  }
+ContextA64 ExecEngine::loadRegisterAArch64(int vecs) {
+  // host_call_asm switches all the vector registers, the untransferred ones
+  // mustn't be stack garbage
+  ContextA64 ctx{};
+  int ids[64];
+  void *vals[64];
+  auto count = context_registers(ctx, vecs, ids, vals);
+  uc_reg_read_batch(uc_, ids, vals, count);
   return ctx;
 }
 
-void ExecEngine::saveRegisterX64(const ContextX64 &ctx) {
-  uc_reg_write(uc_, UC_X86_REG_RSP, &ctx.rsp);
-  uc_reg_write(uc_, UC_X86_REG_RBP, &ctx.rbp);
-  uc_reg_write(uc_, UC_X86_REG_RAX, &ctx.rax);
-  uc_reg_write(uc_, UC_X86_REG_RBX, &ctx.rbx);
-  uc_reg_write(uc_, UC_X86_REG_RCX, &ctx.rcx);
-  uc_reg_write(uc_, UC_X86_REG_RDX, &ctx.rdx);
-  uc_reg_write(uc_, UC_X86_REG_RSI, &ctx.rsi);
-  uc_reg_write(uc_, UC_X86_REG_RDI, &ctx.rdi);
-  uc_reg_write(uc_, UC_X86_REG_R8, &ctx.r8);
-  uc_reg_write(uc_, UC_X86_REG_R9, &ctx.r9);
-  uc_reg_write(uc_, UC_X86_REG_R10, &ctx.r10);
-  uc_reg_write(uc_, UC_X86_REG_R11, &ctx.r11);
-  uc_reg_write(uc_, UC_X86_REG_R12, &ctx.r12);
-  uc_reg_write(uc_, UC_X86_REG_R13, &ctx.r13);
-  uc_reg_write(uc_, UC_X86_REG_R14, &ctx.r14);
-  uc_reg_write(uc_, UC_X86_REG_R15, &ctx.r15);
-  for (int i = 0; i < 8; i++) {
-    uc_reg_write(uc_, UC_X86_REG_ST0 + i, &ctx.stmmx[i]);
-  }
-  for (int i = 0; i < 32; i++) {
-    uc_reg_write(uc_, UC_X86_REG_XMM0, &ctx.xmm[i]);
-  }
+void ExecEngine::saveRegisterAArch64(const ContextA64 &ctx, int vecs) {
+  int ids[64];
+  void *vals[64];
+  auto count =
+      context_registers(const_cast<ContextA64 &>(ctx), vecs, ids, vals);
+  uc_reg_write_batch(uc_, ids, vals, count);
+}
+
+ContextX64 ExecEngine::loadRegisterX64(int vecs) {
+  ContextX64 ctx{};
+  int ids[64];
+  void *vals[64];
+  auto count = context_registers(ctx, vecs, ids, vals);
+  uc_reg_read_batch(uc_, ids, vals, count);
+  return ctx;
+}
+
+void ExecEngine::saveRegisterX64(const ContextX64 &ctx, int vecs) {
+  int ids[64];
+  void *vals[64];
+  auto count =
+      context_registers(const_cast<ContextX64 &>(ctx), vecs, ids, vals);
+  uc_reg_write_batch(uc_, ids, vals, count);
 }
 
 struct exec_thread_context_t {
@@ -717,7 +890,63 @@ uint64_t ExecEngine::createStub(uint64_t vmfunc) {
   return reinterpret_cast<uint64_t>(stub);
 }
 
-bool ExecEngine::specialCallProcess(uint64_t &target, uint64_t &retaddr) {
+void ExecEngine::stubCallbackArguments(uint64_t *args, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    Object *iobj;
+    if (robject_->executable(args[i], &iobj)) {
+      auto found = vmstubs_.find(args[i]);
+      if (found == vmstubs_.end()) {
+        // create a new stub for this iobject vm target function
+        found = vmstubs_.insert({args[i], createStub(args[i])}).first;
+        stubvms_.insert({found->second, found->first});
+      }
+      args[i] = found->second;
+    }
+  }
+}
+
+// the host functions which ExecEngine::specialCallProcess handles, they're
+// classified as RCALL_SPECIAL by exec_call_type
+enum SpecialCall {
+  SCALL_NONE,
+  SCALL_THREAD_CREATE,
+  SCALL_LIBCPP_THREAD_CREATE,
+  SCALL_ATEXIT,
+  SCALL_EXIT,
+  SCALL_ABORT,
+  SCALL_STACK_CHK_FAIL,
+  SCALL_CXA_THROW,
+  SCALL_FORK,
+  // redirected to remote client in gadget mode
+  SCALL_PRINT,
+};
+
+static SpecialCall special_call(uint64_t target) {
+  static const std::pair<uint64_t, SpecialCall> specials[] = {
+      {reinterpret_cast<uint64_t>(thread_create), SCALL_THREAD_CREATE},
+      {reinterpret_cast<uint64_t>(libcpp_thread_create),
+       SCALL_LIBCPP_THREAD_CREATE},
+      {reinterpret_cast<uint64_t>(atexit), SCALL_ATEXIT},
+      {reinterpret_cast<uint64_t>(__cxa_atexit), SCALL_ATEXIT},
+      {reinterpret_cast<uint64_t>(exit), SCALL_EXIT},
+      {reinterpret_cast<uint64_t>(abort), SCALL_ABORT},
+      {reinterpret_cast<uint64_t>(__stack_chk_fail), SCALL_STACK_CHK_FAIL},
+      {reinterpret_cast<uint64_t>(__cxa_throw), SCALL_CXA_THROW},
+#if ON_UNIX
+      {reinterpret_cast<uint64_t>(fork), SCALL_FORK},
+#endif
+      {reinterpret_cast<uint64_t>(printf), SCALL_PRINT},
+      {reinterpret_cast<uint64_t>(puts), SCALL_PRINT},
+  };
+  for (auto &s : specials) {
+    if (s.first == target)
+      return s.second;
+  }
+  return SCALL_NONE;
+}
+
+bool ExecEngine::specialCallProcess(uint64_t &target, uint64_t &retaddr,
+                                    uint32_t ctype) {
   uint64_t args[4], backups[4];
   int rids[4], retrid; // register id
   switch (robject_->arch()) {
@@ -757,11 +986,13 @@ bool ExecEngine::specialCallProcess(uint64_t &target, uint64_t &retaddr) {
     uc_reg_read(uc_, rids[i], &args[i]);
   std::memcpy(backups, args, sizeof(args));
 
-  if (reinterpret_cast<uint64_t>(thread_create) == target ||
-      reinterpret_cast<uint64_t>(libcpp_thread_create) == target) {
+  // it has been classified as a non-special function if it's generic
+  auto special = ctype == RCALL_GENERIC ? SCALL_NONE : special_call(target);
+  if (special == SCALL_THREAD_CREATE ||
+      special == SCALL_LIBCPP_THREAD_CREATE) {
     // index of thread and argument in thread_create_func arguments list
     int ientry = 2, iarg = 3;
-    if (reinterpret_cast<uint64_t>(libcpp_thread_create) == target) {
+    if (special == SCALL_LIBCPP_THREAD_CREATE) {
       ientry = 1;
       iarg = 2;
     }
@@ -770,8 +1001,7 @@ bool ExecEngine::specialCallProcess(uint64_t &target, uint64_t &retaddr) {
     // replace to our stub instance
     args[ientry] = reinterpret_cast<uint64_t>(exec_thread_stub);
     args[iarg] = reinterpret_cast<uint64_t>(context);
-  } else if (reinterpret_cast<uint64_t>(atexit) == target ||
-             reinterpret_cast<uint64_t>(__cxa_atexit) == target) {
+  } else if (special == SCALL_ATEXIT) {
     Object *iobj;
     if (robject_->executable(args[0], &iobj)) {
       Atexit aep; // at exit parameters
@@ -784,21 +1014,25 @@ bool ExecEngine::specialCallProcess(uint64_t &target, uint64_t &retaddr) {
       args[0] = reinterpret_cast<uint64_t>(nop_function);
       target = args[0];
     }
-  } else if (reinterpret_cast<uint64_t>(exit) == target) {
+  } else if (special == SCALL_EXIT) {
     exitcode_ = args[0]; // save script's exit code
     target = reinterpret_cast<uint64_t>(nop_function);
     retaddr = reinterpret_cast<uint64_t>(topReturn());
-  } else if (reinterpret_cast<uint64_t>(abort) == target) {
+  } else if (special == SCALL_ABORT) {
     log_print(Runtime, "Abort called in script.");
+    if (tracer_)
+      tracer_->record(TRACE_EXCEPTION, robject_, retaddr);
     dump();
     exitcode_ = -1;
     target = reinterpret_cast<uint64_t>(nop_function);
     retaddr = reinterpret_cast<uint64_t>(topReturn());
-  } else if (reinterpret_cast<uint64_t>(__stack_chk_fail) == target) {
+  } else if (special == SCALL_STACK_CHK_FAIL) {
     log_print(Runtime, "Fatal error, stack overflow checked.");
     dump();
     std::exit(-1);
-  } else if (reinterpret_cast<uint64_t>(__cxa_throw) == target) {
+  } else if (special == SCALL_CXA_THROW) {
+    if (tracer_)
+      tracer_->record(TRACE_EXCEPTION, robject_, retaddr);
 #if ON_WINDOWS || __APPLE__
     log_print(Runtime,
               "Exception thrown in script: exception={:x}, rtti={:x}, "
@@ -833,7 +1067,7 @@ bool ExecEngine::specialCallProcess(uint64_t &target, uint64_t &retaddr) {
     retaddr = reinterpret_cast<uint64_t>(topReturn());
   }
 #if ON_UNIX
-  else if (reinterpret_cast<uint64_t>(fork) == target) {
+  else if (special == SCALL_FORK) {
     target = reinterpret_cast<uint64_t>(nop_function);
 
     auto pid = fork();
@@ -842,22 +1076,11 @@ bool ExecEngine::specialCallProcess(uint64_t &target, uint64_t &retaddr) {
   }
 #endif
   else {
-    for (size_t i = 0; i < std::size(args); i++) {
-      Object *iobj;
-      if (robject_->executable(args[i], &iobj)) {
-        auto found = vmstubs_.find(args[i]);
-        if (found == vmstubs_.end()) {
-          // create a new stub for this iobject vm target function
-          found = vmstubs_.insert({args[i], createStub(args[i])}).first;
-          stubvms_.insert({found->second, found->first});
-        }
-        args[i] = found->second;
-      }
-    }
+    stubCallbackArguments(args, std::size(args));
   }
 
   // redirect printf to remote client
-  if (RunConfig::gadget) {
+  if (special == SCALL_PRINT && RunConfig::gadget) {
     if (reinterpret_cast<uint64_t>(printf) == target) {
       target = reinterpret_cast<uint64_t>(RunConfig::inst()->printf);
     } else if (reinterpret_cast<uint64_t>(puts) == target) {
@@ -876,6 +1099,66 @@ bool ExecEngine::specialCallProcess(uint64_t &target, uint64_t &retaddr) {
   return update;
 }
 
+void ExecEngine::hostCall(void *context, uint64_t target, uint64_t retaddr) {
+  if (tracer_)
+    tracer_->record(TRACE_CALL, nullptr, target);
+  if (!profiler_) {
+    host_call(context, reinterpret_cast<const void *>(target));
+  } else {
+    // the ticks elapsed in the host function are taken as its samples, the
+    // callback into interpreter takes its own samples and moves proftick_ on
+    proftick_ = profiler_->tick();
+    host_call(context, reinterpret_cast<const void *>(target));
+    if (profiler_->tick() != proftick_)
+      profileSample(retaddr - 1, target);
+  }
+  if (tracer_)
+    tracer_->record(TRACE_RETURN, robject_, retaddr);
+}
+
+void ExecEngine::profileSample(uint64_t pc, uint64_t host) {
+  auto tick = profiler_->tick();
+  auto weight = tick - proftick_;
+  proftick_ = tick;
+
+  auto locate = [this](uint64_t vm) -> Object * {
+    Object *object = robject_;
+    if (robject_->executable(vm, &object) ||
+        iobject_->executable(vm, &object))
+      return object;
+    return nullptr;
+  };
+  std::vector<Profiler::Frame> frames;
+  if (host)
+    frames.push_back({nullptr, host});
+  if (auto object = locate(pc))
+    frames.push_back({object, pc});
+
+  // walk the frame pointer chain in vm stack, each frame record is
+  // [previous fp, return address]
+  uint64_t fp;
+  uc_reg_read(uc_,
+              robject_->arch() == AArch64 ? UC_ARM64_REG_X29 : UC_X86_REG_RBP,
+              &fp);
+  auto stackbeg = reinterpret_cast<uint64_t>(stack_.data());
+  auto stackend = stackbeg + stack_.size();
+  for (int depth = 0; depth < 128; depth++) {
+    if (fp < stackbeg || fp + 16 > stackend || fp % 8)
+      break;
+    auto record = reinterpret_cast<const uint64_t *>(fp);
+    auto object = locate(record[1]);
+    if (!object)
+      break;
+    // symbolize the call instruction instead of the next one
+    frames.push_back({object, record[1] - 1});
+    if (record[0] <= fp)
+      break;
+    fp = record[0];
+  }
+  if (frames.size())
+    profiler_->sample(frames, weight);
+}
+
 bool ExecEngine::executable(uint64_t target) {
   if (robject_->executable(target, &robject_))
     return true;
@@ -890,7 +1173,7 @@ bool ExecEngine::executable(uint64_t target) {
 }
 
 bool ExecEngine::interpretCallAArch64(const InsnInfo *&inst, uint64_t &pc,
-                                      uint64_t target) {
+                                      uint64_t target, uint32_t ctype) {
   auto retaddr = pc + inst->len;
 #if LOG_EXECUTION
   log_print(Develop, "Calling {:x} from {:x}", robject_->vm2vrva(target),
@@ -898,22 +1181,25 @@ bool ExecEngine::interpretCallAArch64(const InsnInfo *&inst, uint64_t &pc,
 #endif
 
   if (executable(target)) {
+    if (tracer_)
+      tracer_->record(TRACE_CALL, robject_, target);
     // call internal function
     // set return address
     uc_reg_write(uc_, UC_ARM64_REG_LR, &retaddr);
     pc = target;
-    inst = robject_->insnInfo(pc); // update current inst
+    inst = insnInfo(pc); // update current inst
     return true;
   } else {
     // check and process some api which has callback argument
-    specialCallProcess(target, retaddr);
+    if (ctype != RCALL_LEAF)
+      specialCallProcess(target, retaddr, ctype);
 
     // call external function
     if (target != reinterpret_cast<uint64_t>(nop_function)) {
-      auto context = loadRegisterAArch64();
+      auto context = loadRegisterAArch64(a64_vecs_arg);
       context.r[A64_LR] = retaddr; // set return address
-      host_call(&context, reinterpret_cast<const void *>(target));
-      saveRegisterAArch64(context);
+      hostCall(&context, target, retaddr);
+      saveRegisterAArch64(context, a64_vecs_ret);
     }
 
     // finish interpreting
@@ -926,33 +1212,34 @@ bool ExecEngine::interpretCallAArch64(const InsnInfo *&inst, uint64_t &pc,
 }
 
 bool ExecEngine::interpretJumpAArch64(const InsnInfo *&inst, uint64_t &pc,
-                                      uint64_t target) {
+                                      uint64_t target, uint32_t ctype) {
   if (executable(target)) {
     // jump to internal destination
     pc = target;
-    inst = robject_->insnInfo(pc); // update current inst
+    inst = insnInfo(pc); // update current inst
     return true;
   } else {
     // jump to external function
-    auto context = loadRegisterAArch64();
+    auto context = loadRegisterAArch64(a64_vecs_arg);
     auto retaddr = context.r[A64_LR];
     if (executable(retaddr) ||
         topReturn() == reinterpret_cast<void *>(retaddr)) {
       // check and process some api which has callback argument
-      bool update = specialCallProcess(target, retaddr);
+      bool update = ctype != RCALL_LEAF &&
+                    specialCallProcess(target, retaddr, ctype);
 
       if (target != reinterpret_cast<uint64_t>(nop_function)) {
         if (update)
-          context = loadRegisterAArch64();
-        host_call(&context, reinterpret_cast<const void *>(target));
-        saveRegisterAArch64(context);
+          context = loadRegisterAArch64(a64_vecs_arg);
+        hostCall(&context, target, retaddr);
+        saveRegisterAArch64(context, a64_vecs_ret);
       }
 
       // return to caller
       pc = retaddr;
       if (retaddr != reinterpret_cast<uint64_t>(topReturn())) {
         // update current inst
-        inst = robject_->insnInfo(pc);
+        inst = insnInfo(pc);
       }
       return true;
     }
@@ -963,10 +1250,10 @@ bool ExecEngine::interpretJumpAArch64(const InsnInfo *&inst, uint64_t &pc,
 
 void ExecEngine::interpretPCLdrAArch64(const InsnInfo *&inst, uint64_t &pc) {
   // encoded meta data layout of all LDRxL:[uint16_t, uint64_t]
-  auto metaptr = robject_->metaInfo<uint16_t>(inst, pc);
+  auto metaptr = robject_->metaInfo<uint16_t>(inst);
   uint64_t target = 0;
   if (inst->rflag)
-    target = reinterpret_cast<uint64_t>(robject_->relocTarget(inst->reloc));
+    target = reinterpret_cast<uint64_t>(robject_->relocTarget(inst));
   else
     target = pc;
   target += (*reinterpret_cast<const uint64_t *>(&metaptr[1]) << 2);
@@ -974,7 +1261,7 @@ void ExecEngine::interpretPCLdrAArch64(const InsnInfo *&inst, uint64_t &pc) {
 }
 
 bool ExecEngine::interpretCallX64(const InsnInfo *&inst, uint64_t &pc,
-                                  uint64_t target) {
+                                  uint64_t target, uint32_t ctype) {
   auto retaddr = pc + inst->len;
 #if LOG_EXECUTION
   log_print(Develop, "Calling {:x} from {:x}", robject_->vm2vrva(target),
@@ -982,6 +1269,8 @@ bool ExecEngine::interpretCallX64(const InsnInfo *&inst, uint64_t &pc,
 #endif
 
   if (executable(target)) {
+    if (tracer_)
+      tracer_->record(TRACE_CALL, robject_, target);
     uint64_t rsp;
     uc_reg_read(uc_, UC_X86_REG_RSP, &rsp);
     // push return address
@@ -990,17 +1279,18 @@ bool ExecEngine::interpretCallX64(const InsnInfo *&inst, uint64_t &pc,
     uc_reg_write(uc_, UC_X86_REG_RSP, &rsp);
     // call internal function
     pc = target;
-    inst = robject_->insnInfo(pc); // update current inst
+    inst = insnInfo(pc); // update current inst
     return true;
   } else {
     // check and process some api which has callback argument
-    specialCallProcess(target, retaddr);
+    if (ctype != RCALL_LEAF)
+      specialCallProcess(target, retaddr, ctype);
 
     // call external function
     if (target != reinterpret_cast<uint64_t>(nop_function)) {
-      auto context = loadRegisterX64();
-      host_call(&context, reinterpret_cast<const void *>(target));
-      saveRegisterX64(context);
+      auto context = loadRegisterX64(x64_vecs_arg);
+      hostCall(&context, target, retaddr);
+      saveRegisterX64(context, x64_vecs_ret);
     }
 
     // finish interpreting
@@ -1013,28 +1303,29 @@ bool ExecEngine::interpretCallX64(const InsnInfo *&inst, uint64_t &pc,
 }
 
 bool ExecEngine::interpretJumpX64(const InsnInfo *&inst, uint64_t &pc,
-                                  uint64_t target) {
+                                  uint64_t target, uint32_t ctype) {
   if (executable(target)) {
     // jump to internal destination
     pc = target;
-    inst = robject_->insnInfo(pc); // update current inst
+    inst = insnInfo(pc); // update current inst
     return true;
   } else {
     // jump to external function
     uint64_t rsp, retaddr;
     uc_reg_read(uc_, UC_X86_REG_RSP, &rsp);
     retaddr = *reinterpret_cast<uint64_t *>(rsp);
-    auto context = loadRegisterX64();
+    auto context = loadRegisterX64(x64_vecs_arg);
     if (executable(retaddr) ||
         topReturn() == reinterpret_cast<void *>(retaddr)) {
       // check and process some api which has callback argument
-      bool update = specialCallProcess(target, retaddr);
+      bool update = ctype != RCALL_LEAF &&
+                    specialCallProcess(target, retaddr, ctype);
 
       if (target != reinterpret_cast<uint64_t>(nop_function)) {
         if (update)
-          context = loadRegisterX64();
-        host_call(&context, reinterpret_cast<const void *>(target));
-        saveRegisterX64(context);
+          context = loadRegisterX64(x64_vecs_arg);
+        hostCall(&context, target, retaddr);
+        saveRegisterX64(context, x64_vecs_ret);
       }
 
       // return to caller
@@ -1044,7 +1335,7 @@ bool ExecEngine::interpretJumpX64(const InsnInfo *&inst, uint64_t &pc,
       uc_reg_write(uc_, UC_X86_REG_RSP, &rsp);
       if (retaddr != reinterpret_cast<uint64_t>(topReturn())) {
         // update current inst
-        inst = robject_->insnInfo(pc);
+        inst = insnInfo(pc);
       }
       return true;
     }
@@ -1056,7 +1347,7 @@ bool ExecEngine::interpretJumpX64(const InsnInfo *&inst, uint64_t &pc,
 uint64_t ExecEngine::interpretCalcMemX64(const InsnInfo *&inst, uint64_t &pc,
                                          int memop, const uint16_t **opsptr) {
   // reg is uint16_t, imm is uint64_t in meta array stream
-  auto ops = robject_->metaInfo<uint16_t>(inst, pc);
+  auto ops = robject_->metaInfo<uint16_t>(inst);
   if (opsptr)
     *opsptr = ops;
   // memop indicates the memory operands startup index in uint16_t meta array
@@ -1087,7 +1378,7 @@ uint64_t ExecEngine::interpretCalcMemX64(const InsnInfo *&inst, uint64_t &pc,
         offimm = 0;
 
       // relocate to other runtime address
-      memaddr = reinterpret_cast<uint64_t>(robject_->relocTarget(inst->reloc)) +
+      memaddr = reinterpret_cast<uint64_t>(robject_->relocTarget(inst)) +
                 offimm;
     } else {
       // adjust location with instruction length
@@ -1281,63 +1572,6 @@ void ExecEngine::interpretCondMovRegMem(const InsnInfo *&inst, uint64_t &pc) {
   }
 }
 
-static bool can_emulate(const InsnInfo *inst) {
-  switch (inst->type) {
-  case INSN_CONDJUMP:
-  case INSN_ARM64_RETURN:
-  case INSN_ARM64_SYSCALL:
-  case INSN_ARM64_CALL:
-  case INSN_ARM64_CALLREG:
-  case INSN_ARM64_JUMP:
-  case INSN_ARM64_JUMPREG:
-  case INSN_X64_RETURN:
-  case INSN_X64_SYSCALL:
-  case INSN_X64_CALL:
-  case INSN_X64_CALLREG:
-  case INSN_X64_CALLMEM:
-  case INSN_X64_JUMP:
-  case INSN_X64_JUMPCOND:
-  case INSN_X64_JUMPREG:
-  case INSN_X64_JUMPMEM:
-  case INSN_X64_CMP8MI:
-  case INSN_X64_CMP8MI8:
-  case INSN_X64_CMP16MI:
-  case INSN_X64_CMP16MI8:
-  case INSN_X64_CMP32MI:
-  case INSN_X64_CMP32MI8:
-  case INSN_X64_CMP64MI32:
-  case INSN_X64_CMP64MI8:
-  case INSN_X64_CMP8RM:
-  case INSN_X64_CMP16RM:
-  case INSN_X64_CMP32RM:
-  case INSN_X64_CMP64RM:
-  case INSN_X64_CMP8MR:
-  case INSN_X64_CMP16MR:
-  case INSN_X64_CMP32MR:
-  case INSN_X64_CMP64MR:
-  case INSN_X64_TEST8MI:
-  case INSN_X64_TEST8MR:
-  case INSN_X64_TEST16MI:
-  case INSN_X64_TEST16MR:
-  case INSN_X64_TEST32MI:
-  case INSN_X64_TEST32MR:
-  case INSN_X64_TEST64MI32:
-  case INSN_X64_TEST64MR:
-    return false;
-  case INSN_HARDWARE:
-    return true;
-  default:
-    // if the current instruction contains relocation or non-code
-    // segment register, then it must be interpreted otherwise can
-    // be emulated.
-#if ARCH_X64
-    if (inst->segflag)
-      return false;
-#endif
-    return inst->rflag == 0;
-  }
-}
-
 #include "exec-x64.inc"
 
 bool ExecEngine::interpret(const InsnInfo *&inst, uint64_t &pc, int &step) {
@@ -1345,27 +1579,34 @@ bool ExecEngine::interpret(const InsnInfo *&inst, uint64_t &pc, int &step) {
   // instructions manually, the unicorn engine can just execute those simple
   // instructions (i.e., instruction without relocation and jump operation) in
   // our case
+  if (superblock_ && !robject_->superblockExit(inst)) {
+    // let unicorn run until it reaches a superblock exit
+    step = 0;
+    return false;
+  }
   unsigned origstep = step;
+  // count the instructions that can be passed to uc_emu_start, the lazily
+  // decoded ones are indexed by rva slot and the scan stops at the first one
+  // which hasn't been published
+  auto lazy = robject_->lazy();
   auto curi = inst;
-  if (step <= 0) {
-    // calculate the maximized steps that can be passed to uc_emu_start
-    for (step = 0; can_emulate(curi); curi++, step++)
-      ;
-  } else {
-    // check whether the step-count instructions have relocation/jump-operation
-    // or not if so, the step size should be re-adjusted
-    int tmpstep = 0;
-    for (; can_emulate(curi); curi++, tmpstep++)
-      ;
-    step = std::min(step, tmpstep);
+  auto curpc = pc;
+  int tmpstep = 0;
+  while (curi && can_emulate(curi)) {
+    tmpstep++;
+    curpc += curi->len;
+    curi = lazy ? robject_->decodedInsn(curpc) : curi + 1;
   }
+  // the step-count instructions may have relocation/jump-operation, if so the
+  // step size should be re-adjusted
+  step = step <= 0 ? tmpstep : std::min(step, tmpstep);
   if (step) {
     // indicates the current instruction hasn't been processed and should let
     // uc_emu_start continue to execute it
     return false;
   }
   // interpret the pre-decoded instructions
-  for (unsigned i = 0; i < origstep && !can_emulate(inst); i++) {
+  for (unsigned i = 0; i < origstep && interpretable(inst); i++) {
 #if LOG_EXECUTION
     log_print(Develop, "Interpret {:x} I{}", robject_->vm2vrva(pc), inst->type);
 #endif
@@ -1392,7 +1633,7 @@ bool ExecEngine::interpret(const InsnInfo *&inst, uint64_t &pc, int &step) {
       uc_reg_read(uc_, UC_ARM64_REG_LR, &retaddr);
       if (executable(retaddr)) {
         pc = retaddr;
-        inst = robject_->insnInfo(pc);
+        inst = insnInfo(pc);
         jump = true;
       } else if (reinterpret_cast<const void *>(retaddr) == topReturn()) {
         pc = retaddr; // finished interpreting
@@ -1409,18 +1650,20 @@ bool ExecEngine::interpret(const InsnInfo *&inst, uint64_t &pc, int &step) {
     // encoded meta data layout:[uint64_t]
     case INSN_ARM64_CALL: {
       uint64_t target;
+      uint32_t ctype = RCALL_UNKNOWN;
       if (inst->rflag) {
-        target = reinterpret_cast<uint64_t>(robject_->relocTarget(inst->reloc));
+        target = reinterpret_cast<uint64_t>(robject_->relocTarget(inst));
+        ctype = robject_->relocCallType(inst);
       } else {
-        auto metaptr = robject_->metaInfo<uint64_t>(inst, pc);
+        auto metaptr = robject_->metaInfo<uint64_t>(inst);
         target = pc + (metaptr[0] << 2);
       }
-      jump = interpretCallAArch64(inst, pc, target);
+      jump = interpretCallAArch64(inst, pc, target, ctype);
       break;
     }
     // encoded meta data layout:[uint16_t]
     case INSN_ARM64_CALLREG: {
-      auto metaptr = robject_->metaInfo<uint16_t>(inst, pc);
+      auto metaptr = robject_->metaInfo<uint16_t>(inst);
       uint64_t target;
       uc_reg_read(uc_, metaptr[0], &target);
       target = checkStub(target);
@@ -1430,18 +1673,20 @@ bool ExecEngine::interpret(const InsnInfo *&inst, uint64_t &pc, int &step) {
     // encoded meta data layout:[uint64_t]
     case INSN_ARM64_JUMP: {
       uint64_t target;
+      uint32_t ctype = RCALL_UNKNOWN;
       if (inst->rflag) {
-        target = reinterpret_cast<uint64_t>(robject_->relocTarget(inst->reloc));
+        target = reinterpret_cast<uint64_t>(robject_->relocTarget(inst));
+        ctype = robject_->relocCallType(inst);
       } else {
-        auto metaptr = robject_->metaInfo<uint64_t>(inst, pc);
+        auto metaptr = robject_->metaInfo<uint64_t>(inst);
         target = pc + (metaptr[0] << 2);
       }
-      jump = interpretJumpAArch64(inst, pc, target);
+      jump = interpretJumpAArch64(inst, pc, target, ctype);
       break;
     }
     // encoded meta data layout:[uint16_t]
     case INSN_ARM64_JUMPREG: {
-      auto metaptr = robject_->metaInfo<uint16_t>(inst, pc);
+      auto metaptr = robject_->metaInfo<uint16_t>(inst);
       uint64_t target;
       uc_reg_read(uc_, metaptr[0], &target);
       target = checkStub(target);
@@ -1451,10 +1696,10 @@ bool ExecEngine::interpret(const InsnInfo *&inst, uint64_t &pc, int &step) {
     // encoded meta data layout:[uint16_t, uint64_t]
     case INSN_ARM64_ADR:
     case INSN_ARM64_ADRP: {
-      auto metaptr = robject_->metaInfo<uint16_t>(inst, pc);
+      auto metaptr = robject_->metaInfo<uint16_t>(inst);
       uint64_t target = 0;
       if (inst->rflag) {
-        target = reinterpret_cast<uint64_t>(robject_->relocTarget(inst->reloc));
+        target = reinterpret_cast<uint64_t>(robject_->relocTarget(inst));
       } else {
         auto imm = *reinterpret_cast<const uint64_t *>(&metaptr[1]);
         if (inst->type == INSN_ARM64_ADRP)
@@ -1482,11 +1727,11 @@ bool ExecEngine::interpret(const InsnInfo *&inst, uint64_t &pc, int &step) {
       // pop return address
       rsp += 8;
       // instruction: retn bytes
-      rsp += *robject_->metaInfo<uint64_t>(inst, pc);
+      rsp += *robject_->metaInfo<uint64_t>(inst);
       uc_reg_write(uc_, UC_X86_REG_RSP, &rsp);
       pc = retaddr;
       if (executable(retaddr)) {
-        inst = robject_->insnInfo(pc);
+        inst = insnInfo(pc);
         jump = true;
       } else if (reinterpret_cast<const void *>(retaddr) == topReturn()) {
         // finished interpreting
@@ -1503,18 +1748,20 @@ bool ExecEngine::interpret(const InsnInfo *&inst, uint64_t &pc, int &step) {
     // encoded meta data layout:[uint64_t]
     case INSN_X64_CALL: {
       uint64_t target;
+      uint32_t ctype = RCALL_UNKNOWN;
       if (inst->rflag) {
-        target = reinterpret_cast<uint64_t>(robject_->relocTarget(inst->reloc));
+        target = reinterpret_cast<uint64_t>(robject_->relocTarget(inst));
+        ctype = robject_->relocCallType(inst);
       } else {
-        auto metaptr = robject_->metaInfo<uint64_t>(inst, pc);
+        auto metaptr = robject_->metaInfo<uint64_t>(inst);
         target = pc + metaptr[0] + inst->len;
       }
-      jump = interpretCallX64(inst, pc, target);
+      jump = interpretCallX64(inst, pc, target, ctype);
       break;
     }
     // encoded meta data layout:[uint16_t]
     case INSN_X64_CALLREG: {
-      auto metaptr = robject_->metaInfo<uint16_t>(inst, pc);
+      auto metaptr = robject_->metaInfo<uint16_t>(inst);
       uint64_t target;
       uc_reg_read(uc_, metaptr[0], &target);
       target = checkStub(target);
@@ -1532,13 +1779,15 @@ bool ExecEngine::interpret(const InsnInfo *&inst, uint64_t &pc, int &step) {
     // encoded meta data layout:[uint64_t]
     case INSN_X64_JUMP: {
       uint64_t target;
+      uint32_t ctype = RCALL_UNKNOWN;
       if (inst->rflag) {
-        target = reinterpret_cast<uint64_t>(robject_->relocTarget(inst->reloc));
+        target = reinterpret_cast<uint64_t>(robject_->relocTarget(inst));
+        ctype = robject_->relocCallType(inst);
       } else {
-        auto metaptr = robject_->metaInfo<uint64_t>(inst, pc);
+        auto metaptr = robject_->metaInfo<uint64_t>(inst);
         target = pc + metaptr[0] + inst->len;
       }
-      jump = interpretJumpX64(inst, pc, target);
+      jump = interpretJumpX64(inst, pc, target, ctype);
       break;
     }
     // encoded meta data layout:[uint64_t, uint64_t]
@@ -1550,18 +1799,19 @@ bool ExecEngine::interpret(const InsnInfo *&inst, uint64_t &pc, int &step) {
       }
 
       uint64_t target =
-          reinterpret_cast<uint64_t>(robject_->relocTarget(inst->reloc));
-      auto metaptr = robject_->metaInfo<uint16_t>(inst, pc);
+          reinterpret_cast<uint64_t>(robject_->relocTarget(inst));
+      auto metaptr = robject_->metaInfo<uint16_t>(inst);
       ContextX64 context{0};
       uc_reg_read(uc_, UC_X86_REG_RCX, &context.rcx);
       uc_reg_read(uc_, UC_X86_REG_RFLAGS, &context.rflags);
       if (hitCondX64(&context, metaptr[4]))
-        jump = interpretJumpX64(inst, pc, target);
+        jump = interpretJumpX64(inst, pc, target,
+                                robject_->relocCallType(inst));
       break;
     }
     // encoded meta data layout:[uint16_t]
     case INSN_X64_JUMPREG: {
-      auto metaptr = robject_->metaInfo<uint16_t>(inst, pc);
+      auto metaptr = robject_->metaInfo<uint16_t>(inst);
       uint64_t target;
       uc_reg_read(uc_, metaptr[0], &target);
       target = checkStub(target);
@@ -1781,7 +2031,7 @@ bool ExecEngine::interpret(const InsnInfo *&inst, uint64_t &pc, int &step) {
     // advance to the next instruction if didn't jump
     if (!jump) {
       pc += inst->len;
-      inst++;
+      inst = robject_->lazy() ? insnInfo(pc) : inst + 1;
     }
   }
   // indicates the current instruction has been processed
@@ -1813,11 +2063,7 @@ bool ExecEngine::execLoop(uint64_t pc) {
     return false;
   }
   // instruction information related to pc
-  auto inst = robject_->insnInfo(pc);
-  // cache the last jump destination, it can make loop running faster
-  // because of avoiding dynamic searching for the target instruction
-  auto lastjpc = pc;
-  auto lastjinst = inst;
+  auto inst = insnInfo(pc);
   // executing loop, break when hitting the initialized return address
   while (pc != reinterpret_cast<uint64_t>(topReturn())) {
     // debugging
@@ -1828,6 +2074,9 @@ bool ExecEngine::execLoop(uint64_t pc) {
         break;
       }
     }
+    // sampling profiler
+    if (profiler_ && profiler_->tick() != proftick_)
+      profileSample(pc);
 
     // interpret relocation, branch, call, jump and syscall etc.
     auto step = RunConfig::inst()->stepSize();
@@ -1846,6 +2095,17 @@ bool ExecEngine::execLoop(uint64_t pc) {
     *tlsepoch = reinterpret_cast<uint64_t>(&epochptr);
 #endif
 
+    if (superblock_ && exitobj_ != robject_) {
+      // stop at the instructions which should be interpreted
+      auto &exits = robject_->superblockExits();
+      uc_ctl_set_exits(uc_, const_cast<uint64_t *>(exits.data()),
+                       exits.size());
+      exitobj_ = robject_;
+    }
+
+    if (tracer_)
+      tracer_->record(TRACE_BLOCK, robject_, pc);
+
     // running instructions by unicorn engine
     auto err = uc_emu_start(uc_, pc, -1, 0, step);
 
@@ -1856,26 +2116,30 @@ bool ExecEngine::execLoop(uint64_t pc) {
 
     if (err != UC_ERR_OK) {
       log_print(Runtime, "Fatal error occurred: {}.", uc_strerror(err));
+      if (tracer_)
+        tracer_->record(TRACE_EXCEPTION, robject_, pc);
       dump();
       std::exit(-1);
     }
 
     // update current pc
     uc_reg_read(uc_, pcreg, &pc);
+    if (superblock_) {
+      // unicorn may have run across some branches
+      inst = insnInfo(pc);
+      continue;
+    }
+    if (robject_->lazy()) {
+      // the lazy slots aren't adjacent instructions
+      inst = insnInfo(pc);
+      continue;
+    }
     // update inst with step
     inst += step;
     // check whether the last instruction is jump type
     if (inst->rva != robject_->vm2rvaSimple(pc)) {
-      if (pc == lastjpc) {
-        // use the cached instruction
-        inst = lastjinst;
-      } else {
-        // dynamically search the destination instruction
-        inst = robject_->insnInfo(pc);
-        // cache the jump destination instruction
-        lastjinst = inst;
-        lastjpc = pc;
-      }
+      // it's a jump destination, which is likely to be cached
+      inst = insnInfo(pc);
     }
   }
   if (debugger_)
@@ -1990,7 +2254,8 @@ int ExecEngine::run(bool lib) {
 
   if (execCtor()) {
     if (!lib && execMain()) {
-      if (!robject_->isCache() && !RunConfig::repl && !RunConfig::gadget &&
+      if ((!robject_->isCache() || robject_->cacheOutdated()) &&
+          robject_->cacheable() && !RunConfig::repl && !RunConfig::gadget &&
           !exitcode_ &&
           !robject_->cachePath().starts_with(
               fs::temp_directory_path().string())) {
@@ -2036,6 +2301,19 @@ void exec_object(std::shared_ptr<Object> object) {
   ExecEngine(object, deps, iargs).run();
 }
 
+int exec_object(std::shared_ptr<Object> object, int iargc,
+                const char **iargv) {
+  if (!object->valid())
+    return -1;
+
+  std::vector<std::string> deps;
+  std::vector<const char *> iargs;
+  iargs.push_back(object->path().data());
+  for (int i = 0; i < iargc - 1; i++)
+    iargs.push_back(iargv[i]);
+  return ExecEngine(object, deps, iargs).run();
+}
+
 void init_library(std::shared_ptr<Object> imod) {
   std::vector<std::string> deps;
   std::vector<const char *> iargs;
@@ -2043,4 +2321,39 @@ void init_library(std::shared_ptr<Object> imod) {
   ExecEngine(imod, deps, iargs).run(true);
 }
 
+uint32_t exec_call_type(const void *target) {
+  auto addr = reinterpret_cast<uint64_t>(target);
+  if (special_call(addr) != SCALL_NONE)
+    return RCALL_SPECIAL;
+  // the frequently called host functions which never call back
+  uint64_t leaves[] = {
+      reinterpret_cast<uint64_t>(malloc),
+      reinterpret_cast<uint64_t>(calloc),
+      reinterpret_cast<uint64_t>(realloc),
+      reinterpret_cast<uint64_t>(free),
+      reinterpret_cast<uint64_t>(
+          static_cast<void *(*)(std::size_t)>(::operator new)),
+      reinterpret_cast<uint64_t>(
+          static_cast<void *(*)(std::size_t)>(::operator new[])),
+      reinterpret_cast<uint64_t>(
+          static_cast<void (*)(void *)>(::operator delete)),
+      reinterpret_cast<uint64_t>(
+          static_cast<void (*)(void *)>(::operator delete[])),
+      reinterpret_cast<uint64_t>(strlen),
+      reinterpret_cast<uint64_t>(strcmp),
+      reinterpret_cast<uint64_t>(strncmp),
+      reinterpret_cast<uint64_t>(strcpy),
+      reinterpret_cast<uint64_t>(strncpy),
+      reinterpret_cast<uint64_t>(memcpy),
+      reinterpret_cast<uint64_t>(memmove),
+      reinterpret_cast<uint64_t>(memset),
+      reinterpret_cast<uint64_t>(memcmp),
+  };
+  for (auto l : leaves) {
+    if (l == addr)
+      return RCALL_LEAF;
+  }
+  return RCALL_GENERIC;
+}
+
 } // namespace icpp
@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <string_view>
 #include <vector>
@@ -33,7 +34,14 @@ int exec_repl(const char *argv0);
 // execute the memory loaded object
 void exec_object(std::shared_ptr<Object> object);
 
+// execute the memory compiled snippet object with arguments
+int exec_object(std::shared_ptr<Object> object, int iargc,
+                const char **iargv);
+
 // execute the dynamically loaded module's constructors
 void init_library(std::shared_ptr<Object> imod);
 
+// classify the host function target as one of RelocCallType
+uint32_t exec_call_type(const void *target);
+
 } // namespace icpp
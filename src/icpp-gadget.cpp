@@ -13,13 +13,21 @@
 #include "runcfg.h"
 #include "utils.h"
 #include <boost/asio.hpp>
+#include <brotli/decode.h>
 #include <cstdarg>
 #include <icppdbg.pb.h>
 #include <icpppad.pb.h>
+#include <llvm/ADT/StringExtras.h>
 #include <llvm/Object/ObjectFile.h>
 #include <llvm/Support/CommandLine.h>
 #include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/xxhash.h>
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include <memory>
 #include <mutex>
+#include <unordered_map>
 #include <unicorn/unicorn.h>
 
 namespace cl = llvm::cl;
@@ -33,9 +41,109 @@ cl::OptionCategory ISERVER("ICPP Remote Gadget Server Options");
 
 static cl::opt<int> Port("port", cl::desc("Set the listening port."),
                          cl::init(0), cl::cat(ISERVER));
+static cl::opt<int>
+    Workers("workers",
+            cl::desc("Set the count of the concurrently running objects."),
+            cl::init(2), cl::cat(ISERVER));
+static cl::opt<int> CacheBudget(
+    "cache-budget",
+    cl::desc("Set the memory budget in MB of the decoded objects kept for "
+             "rerunning, 0 means off."),
+    cl::init(128), cl::cat(ISERVER));
+
+// the unsent bytes of a client, its script output is dropped rather than
+// stalling the running objects if it can't keep up with them
+constexpr const size_t client_pending_limit = 16 * 1024 * 1024;
+// the RUN commands being run or waiting for a free worker
+constexpr const int run_pending_limit = 16;
+// the received objects are kept for RUNHASH, the least recently used ones are
+// evicted once they exceed this size
+constexpr const size_t object_cache_limit = 64 * 1024 * 1024;
+// the maximum uncompressed size of a received object
+constexpr const uint64_t object_size_limit = 1ULL << 30;
+static_assert(object_size_limit < protocol_body_limit);
+// the protocol revision reported by SYNCENV
+constexpr const uint32_t protocol_revision = 2;
 
 static bool running;
 
+class gadget;
+
+/*
+cache of the decoded objects keyed by the hash of their payloads, the
+repeated injections of the same object skip parsing, relocating and decoding.
+
+an object is taken away while it's running and put back to be restored for
+the next run, the least recently used ones are evicted once the memory usage
+of all exceeds the budget.
+*/
+class ObjectCache {
+public:
+  uint64_t budget() {
+    return static_cast<uint64_t>(std::max<int>(CacheBudget, 0)) * 1024 * 1024;
+  }
+
+  std::shared_ptr<Object> take(uint64_t hash);
+  void put(uint64_t hash, std::shared_ptr<Object> object);
+  iopad::CacheStats stats();
+
+private:
+  struct Entry {
+    uint64_t hash;
+    uint64_t usage;
+    std::shared_ptr<Object> object;
+  };
+
+  std::mutex mutex_;
+  uint64_t usage_ = 0;
+  uint64_t hits_ = 0, misses_ = 0, evictions_ = 0;
+  // the most recently used one is at front
+  std::list<Entry> lru_;
+  std::unordered_map<uint64_t, std::list<Entry>::iterator> index_;
+};
+
+/*
+a connected iopad client.
+
+all of its socket operations run on its own strand of the single io_context,
+the frames are queued and written in batches, and the consecutive script
+outputs are coalesced into one respond.
+*/
+class client : public std::enable_shared_from_this<client> {
+public:
+  client(gadget *server, ip::tcp::socket socket)
+      : server_(server), socket_(std::move(socket)) {}
+
+  void start();
+  void close();
+
+  // queue a frame or script output, they're safe to call on any thread
+  void send(iopad::CommandID id, std::string body);
+  void output(std::string text);
+
+private:
+  void readHeader();
+  void readBody();
+  // move the coalesced output to the frame queue
+  void seal();
+  void flush();
+
+  gadget *server_;
+  ip::tcp::socket socket_;
+  ProtocolHdr hdr_;
+  uint64_t bodylen_ = 0;
+  std::string body_;
+  // the queued frames, the output after them and the frames being written,
+  // they're only accessed on the strand
+  std::string queued_;
+  std::string text_;
+  std::string writing_;
+  size_t accounted_ = 0, written_ = 0;
+  // the accounted bytes of the above and the dropped outputs
+  std::atomic<size_t> pending_{0};
+  std::atomic<uint64_t> dropped_{0};
+};
+
 class gadget {
 public:
   gadget();
@@ -46,16 +154,45 @@ public:
   template <typename... Args>
   int print(std::format_string<Args...> format, Args &&...args);
 
+  std::string syncEnv();
+  void process(client *c, const ProtocolHdr *hdr, const void *body,
+               size_t size);
+  void remove(client *c);
+
 private:
   int listen();
-  void recv(ip::tcp::socket *socket);
-  void process(const ProtocolHdr *hdr, const void *body, size_t size);
-  void procRun(std::string_view name, const std::string &obuff);
-
-  asio::io_service ios_;
+  void accept();
+  // decompress, verify and cache the object buffer of the RUN command, the
+  // failure reason is set to error
+  std::shared_ptr<const std::string> unpack(iopad::CommandRun &cmd,
+                                            uint64_t &hash, std::string &error);
+  // run the object on the workers and respond to the issuing client c
+  void run(std::shared_ptr<client> c, std::string name, uint64_t hash,
+           std::shared_ptr<const std::string> obuff);
+  void procRun(std::string_view name, uint64_t hash,
+               const std::string &obuff);
+  std::shared_ptr<Object> createObject(std::string_view name,
+                                       const std::string &obuff);
+
+  asio::io_context ios_;
   std::unique_ptr<ip::tcp::acceptor> acceptor_;
-  std::vector<std::unique_ptr<ip::tcp::socket>> clients_;
+  std::vector<std::shared_ptr<client>> clients_;
   std::mutex mutex_;
+  // the objects are run on the workers, so that the network thread is never
+  // blocked, it's never deleted as a script may exit on a worker thread
+  asio::thread_pool *workers_ = nullptr;
+  std::atomic<int> runs_{0};
+  // <hash, object buffer> of the received objects and their lru order, the
+  // most recently used one is at back, they're only accessed on the network
+  // thread
+  struct ObjectEntry {
+    std::shared_ptr<const std::string> buffer;
+    std::list<uint64_t>::iterator order;
+  };
+  std::unordered_map<uint64_t, ObjectEntry> objects_;
+  std::list<uint64_t> objorder_;
+  size_t objsize_ = 0;
+  ObjectCache decoded_;
 } icppsvr;
 
 /*
@@ -71,30 +208,200 @@ int exec_source(const char *argv0, std::string_view path, int argc,
   return -1;
 }
 
-static void send_buffer(ip::tcp::socket *s, iopad::CommandID id,
-                        const std::string_view &respbuf) {
-  std::string buff;
-  buff.resize(sizeof(icpp::ProtocolHdr) + respbuf.length());
-  auto hdr = reinterpret_cast<icpp::ProtocolHdr *>(buff.data());
-  hdr->cmd = id;
-  hdr->len = static_cast<uint32_t>(respbuf.length());
-  std::memcpy(&hdr[1], respbuf.data(), respbuf.length());
-
-  boost::system::error_code error;
-  asio::write(*s, asio::buffer(buff), error);
-  if (error) {
-    log_print(Develop, "Failed to send command buffer {}.\n", error.message());
-  }
-}
-
-static void send_respose(ip::tcp::socket *s, iopad::CommandID id,
-                         const std::string &result) {
+static std::string respond_buffer(iopad::CommandID id,
+                                  const std::string &result) {
   iopad::Respond resp;
   resp.set_cmd(id);
   resp.set_result(result);
+  return resp.SerializeAsString();
+}
+
+void client::start() {
+  send(iopad::SYNCENV, server_->syncEnv());
+  asio::dispatch(socket_.get_executor(),
+                 [self = shared_from_this()]() { self->readHeader(); });
+}
+
+void client::close() {
+  asio::post(socket_.get_executor(), [self = shared_from_this()]() {
+    if (!self->socket_.is_open())
+      return;
+    boost::system::error_code error;
+    self->socket_.close(error);
+    self->server_->remove(self.get());
+  });
+}
+
+void client::send(iopad::CommandID id, std::string body) {
+  auto frame = protocol_frame(id, body);
+  pending_ += frame.size();
+  asio::post(socket_.get_executor(), [self = shared_from_this(),
+                                      frame = std::move(frame)]() {
+    self->seal();
+    self->queued_ += frame;
+    self->accounted_ += frame.size();
+    self->flush();
+  });
+}
+
+void client::output(std::string text) {
+  auto size = text.size();
+  if (pending_.load(std::memory_order_relaxed) + size > client_pending_limit) {
+    // this client is too slow, drop the output rather than waiting for it
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  pending_ += size;
+  asio::post(socket_.get_executor(),
+             [self = shared_from_this(), text = std::move(text)]() {
+               self->text_ += text;
+               self->accounted_ += text.size();
+               self->flush();
+             });
+}
+
+void client::readHeader() {
+  asio::async_read(
+      socket_, asio::buffer(&hdr_, sizeof(hdr_)),
+      [self = shared_from_this()](const boost::system::error_code &error,
+                                  size_t) {
+        if (error) {
+          log_print(Develop,
+                    "Failed to read header buffer: {}.\nClosed connection.",
+                    error.message());
+          self->close();
+          return;
+        }
+        self->bodylen_ = self->hdr_.len;
+        if (self->bodylen_ != protocol_len_extended) {
+          self->readBody();
+          return;
+        }
+        // the body is too large to encode its length in the header
+        asio::async_read(
+            self->socket_,
+            asio::buffer(&self->bodylen_, sizeof(self->bodylen_)),
+            [self](const boost::system::error_code &error, size_t) {
+              if (error) {
+                log_print(Develop, "Failed to read body length: {}.",
+                          error.message());
+                self->close();
+                return;
+              }
+              self->readBody();
+            });
+      });
+}
 
-  auto respbuf = resp.SerializeAsString();
-  send_buffer(s, iopad::RESPONE, respbuf);
+void client::readBody() {
+  if (!protocol_body_valid(bodylen_)) {
+    log_print(Develop,
+              "The body length {} of cmd.{} exceeds the limit.\nClosed "
+              "connection.",
+              bodylen_, hdr_.cmd);
+    close();
+    return;
+  }
+  // protocol body serialized by protobuf
+  body_.resize(bodylen_);
+  asio::async_read(
+      socket_, asio::buffer(body_),
+      [self = shared_from_this()](const boost::system::error_code &error,
+                                  size_t) {
+        if (error) {
+          log_print(Develop, "Failed to read body buffer: {}.",
+                    error.message());
+          self->close();
+          return;
+        }
+        self->server_->process(self.get(), &self->hdr_, self->body_.data(),
+                               self->body_.size());
+        self->readHeader();
+      });
+}
+
+void client::seal() {
+  if (text_.empty())
+    return;
+  queued_ += protocol_frame(iopad::RESPONE,
+                            respond_buffer(iopad::RESPONE, text_));
+  text_.clear();
+}
+
+void client::flush() {
+  if (writing_.size() || !socket_.is_open())
+    return;
+  if (auto dropped = dropped_.exchange(0, std::memory_order_relaxed))
+    text_ += std::format("[icpp-gadget] Dropped {} outputs as this connection "
+                         "is too slow.\n",
+                         dropped);
+  seal();
+  if (queued_.empty())
+    return;
+  // write all the queued frames at once
+  writing_.swap(queued_);
+  written_ = accounted_;
+  accounted_ = 0;
+  asio::async_write(
+      socket_, asio::buffer(writing_),
+      [self = shared_from_this()](const boost::system::error_code &error,
+                                  size_t) {
+        self->pending_ -= self->written_;
+        self->writing_.clear();
+        if (error) {
+          log_print(Develop, "Failed to send command buffer {}.",
+                    error.message());
+          self->close();
+          return;
+        }
+        self->flush();
+      });
+}
+
+std::shared_ptr<Object> ObjectCache::take(uint64_t hash) {
+  std::lock_guard lock(mutex_);
+  auto found = index_.find(hash);
+  if (found == index_.end()) {
+    misses_++;
+    return nullptr;
+  }
+  hits_++;
+  auto object = found->second->object;
+  usage_ -= found->second->usage;
+  lru_.erase(found->second);
+  index_.erase(found);
+  object->restore();
+  return object;
+}
+
+void ObjectCache::put(uint64_t hash, std::shared_ptr<Object> object) {
+  auto usage = object->memoryUsage();
+  std::lock_guard lock(mutex_);
+  auto limit = budget();
+  if (usage > limit || index_.contains(hash))
+    return;
+  lru_.push_front(Entry{hash, usage, object});
+  index_[hash] = lru_.begin();
+  usage_ += usage;
+  while (usage_ > limit) {
+    auto &last = lru_.back();
+    usage_ -= last.usage;
+    index_.erase(last.hash);
+    lru_.pop_back();
+    evictions_++;
+  }
+}
+
+iopad::CacheStats ObjectCache::stats() {
+  std::lock_guard lock(mutex_);
+  iopad::CacheStats stats;
+  stats.set_hits(hits_);
+  stats.set_misses(misses_);
+  stats.set_evictions(evictions_);
+  stats.set_count(lru_.size());
+  stats.set_usage(usage_);
+  stats.set_budget(budget());
+  return stats;
 }
 
 static int gadget_printf(const char *format, ...);
@@ -102,15 +409,18 @@ static int gadget_puts(const char *text);
 
 template <typename... Args>
 int gadget::print(std::format_string<Args...> format, Args &&...args) {
-  std::lock_guard lock(mutex_);
   auto msg = std::vformat(format.get(), std::make_format_args(args...));
-  for (auto &s : clients_) {
-    if (s.get()->is_open())
-      send_respose(s.get(), iopad::RESPONE, msg);
-  }
+  std::lock_guard lock(mutex_);
+  for (auto &c : clients_)
+    c->output(msg);
   return static_cast<int>(msg.length());
 }
 
+void gadget::remove(client *c) {
+  std::lock_guard lock(mutex_);
+  std::erase_if(clients_, [c](auto &it) { return it.get() == c; });
+}
+
 static bool is_icpp_server() {
   constexpr const char *server = "icpp-server";
   if (std::getenv(server))
@@ -156,11 +466,15 @@ gadget::~gadget() {
 
   try {
     // close client sockets
-    for (auto &s : clients_) {
-      if (s->is_open()) {
-        s->close();
-      }
+    std::vector<std::shared_ptr<client>> clients;
+    {
+      std::lock_guard lock(mutex_);
+      clients = clients_;
     }
+    for (auto &c : clients)
+      c->close();
+    if (workers_)
+      workers_->stop();
     // close acceptor
     if (acceptor_)
       acceptor_->close();
@@ -187,64 +501,56 @@ int gadget::listen() {
     return -1;
   }
 
-  while (true) {
+  accept();
+  // all the client connections are served on this thread, an exception of
+  // one handler mustn't bring down the whole process
+  while (running) {
     try {
-      auto socketptr = std::make_unique<ip::tcp::socket>(ios_);
-      // waiting for connection
-      acceptor_->accept(*socketptr);
-      if (!running)
-        break;
-      clients_.push_back(std::move(socketptr));
-      std::thread(&gadget::recv, this, clients_.rbegin()->get()).detach();
-    } catch (boost::system::system_error &error) {
-      log_print(Develop, "Accept error: {}.", error.what());
-#if NDEBUG
+      ios_.run();
       break;
-#endif
+    } catch (std::exception &error) {
+      log_print(Develop, "Client handler error: {}.", error.what());
     }
   }
-
   return 0;
 }
 
-void gadget::recv(ip::tcp::socket *socket) {
-  // let iopad know what kind of environment this icpp-gadget is running
+void gadget::accept() {
+  // each client has its own strand
+  acceptor_->async_accept(
+      asio::make_strand(ios_),
+      [this](const boost::system::error_code &error, ip::tcp::socket socket) {
+        if (!running || error == asio::error::operation_aborted)
+          return;
+        if (error) {
+          log_print(Develop, "Accept error: {}.", error.message());
+        } else {
+          auto c = std::make_shared<client>(this, std::move(socket));
+          {
+            std::lock_guard lock(mutex_);
+            clients_.push_back(c);
+          }
+          c->start();
+        }
+        accept();
+      });
+}
+
+std::string gadget::syncEnv() {
+  // let iopad know what kind of environment this icpp-gadget is running and
+  // which objects it holds
   iopad::CommandSyncEnv cmd;
   cmd.mutable_cmd()->set_id(iopad::SYNCENV);
   cmd.set_arch(static_cast<iopad::ArchType>(host_arch()));
   cmd.set_ostype(static_cast<iopad::SystemType>(host_system()));
-  send_buffer(socket, iopad::SYNCENV, cmd.SerializeAsString());
-
-  while (true) {
-    boost::system::error_code error;
-    // protocol header
-    asio::streambuf hdrbuffer;
-    asio::read(*socket, hdrbuffer,
-               asio::transfer_exactly(sizeof(icpp::ProtocolHdr)), error);
-    if (error) {
-      log_print(Develop,
-                "Failed to read header buffer: {}.\nClosed connection.",
-                error.message());
-      break;
-    }
-    auto hdr = asio::buffer_cast<const icpp::ProtocolHdr *>(hdrbuffer.data());
-    if (!hdr->len) {
-      process(hdr, "", 0);
-      continue;
-    }
-    // protocol body serialized by protobuf
-    asio::streambuf probuffer;
-    asio::read(*socket, probuffer, asio::transfer_exactly(hdr->len), error);
-    if (error && error != asio::error::eof) {
-      log_print(Develop, "Failed to read body buffer: {}.", error.message());
-      continue;
-    }
-    process(hdr, asio::buffer_cast<const void *>(probuffer.data()),
-            probuffer.size());
-  }
+  cmd.set_revision(protocol_revision);
+  for (auto hash : objorder_)
+    cmd.add_objects(hash);
+  return cmd.SerializeAsString();
 }
 
-void gadget::process(const ProtocolHdr *hdr, const void *body, size_t size) {
+void gadget::process(client *c, const ProtocolHdr *hdr, const void *body,
+                     size_t size) {
   switch (hdr->cmd) {
   case iopad::RUN: {
     iopad::CommandRun cmd;
@@ -253,7 +559,35 @@ void gadget::process(const ProtocolHdr *hdr, const void *body, size_t size) {
                 size);
       break;
     }
-    procRun(cmd.name(), cmd.buff());
+    uint64_t hash;
+    std::string error;
+    if (auto obuff = unpack(cmd, hash, error))
+      run(c->shared_from_this(), cmd.name(), hash, obuff);
+    else
+      c->send(iopad::RESPONE, respond_buffer(iopad::RUN, error + "\n"));
+    break;
+  }
+  case iopad::RUNHASH: {
+    iopad::CommandRunHash cmd;
+    if (!cmd.ParseFromArray(body, size)) {
+      log_print(Develop, "Failed to parse buffer cmd.{} size.{}", hdr->cmd,
+                size);
+      break;
+    }
+    auto found = objects_.find(cmd.hash());
+    if (found == objects_.end()) {
+      // let iopad send the whole object
+      c->send(iopad::RESPONE, respond_buffer(iopad::RUNHASH, ""));
+      break;
+    }
+    // mark it as the most recently used one
+    objorder_.splice(objorder_.end(), objorder_, found->second.order);
+    run(c->shared_from_this(), cmd.name(), cmd.hash(), found->second.buffer);
+    break;
+  }
+  case iopad::STATS: {
+    auto stats = decoded_.stats().SerializeAsString();
+    c->send(iopad::RESPONE, respond_buffer(iopad::STATS, stats));
     break;
   }
   default:
@@ -261,8 +595,92 @@ void gadget::process(const ProtocolHdr *hdr, const void *body, size_t size) {
   }
 }
 
-void gadget::procRun(std::string_view name, const std::string &obuff) {
-  auto membuf = llvm::MemoryBuffer::getMemBuffer(obuff);
+std::shared_ptr<const std::string> gadget::unpack(iopad::CommandRun &cmd,
+                                                  uint64_t &hash,
+                                                  std::string &error) {
+  auto obuff = std::make_shared<std::string>();
+  if (cmd.size()) {
+    if (cmd.size() > object_size_limit) {
+      error = std::format("The object {} is too large.", cmd.name());
+      log_print(Runtime, "{}", error);
+      return nullptr;
+    }
+    obuff->resize(cmd.size());
+    size_t decodedsz = obuff->size();
+    if (!BrotliDecoderDecompress(
+            cmd.buff().size(),
+            reinterpret_cast<const uint8_t *>(cmd.buff().data()), &decodedsz,
+            reinterpret_cast<uint8_t *>(obuff->data())) ||
+        decodedsz != obuff->size()) {
+      error = std::format("Failed to decompress the object {}.", cmd.name());
+      log_print(Runtime, "{}", error);
+      return nullptr;
+    }
+  } else {
+    obuff->swap(*cmd.mutable_buff());
+  }
+  hash = llvm::xxh3_64bits(llvm::arrayRefFromStringRef(*obuff));
+  if (cmd.hash() && cmd.hash() != hash) {
+    error = std::format("The object {} is corrupted, its hash mismatched.",
+                        cmd.name());
+    log_print(Runtime, "{}", error);
+    return nullptr;
+  }
+  if (auto found = objects_.find(hash); found != objects_.end()) {
+    objorder_.splice(objorder_.end(), objorder_, found->second.order);
+    return obuff;
+  }
+  objects_.insert({hash, {obuff, objorder_.insert(objorder_.end(), hash)}});
+  objsize_ += obuff->size();
+  while (objsize_ > object_cache_limit && objorder_.size() > 1) {
+    auto found = objects_.find(objorder_.front());
+    objsize_ -= found->second.buffer->size();
+    objects_.erase(found);
+    objorder_.pop_front();
+  }
+  return obuff;
+}
+
+void gadget::run(std::shared_ptr<client> c, std::string name, uint64_t hash,
+                 std::shared_ptr<const std::string> obuff) {
+  // only called on the network thread
+  if (!workers_)
+    workers_ = new asio::thread_pool(std::clamp<int>(Workers, 1, 64));
+  if (runs_.load() >= run_pending_limit) {
+    auto error = std::format("Too many pending objects, dropped {}.", name);
+    log_print(Runtime, "{}", error);
+    c->send(iopad::RESPONE, respond_buffer(iopad::RUN, error + "\n"));
+    return;
+  }
+  runs_++;
+  asio::post(*workers_, [this, c = std::move(c), name = std::move(name), hash,
+                         obuff = std::move(obuff)]() {
+    procRun(name, hash, *obuff);
+    runs_--;
+    // notify the issuing client the execution finished
+    c->send(iopad::RESPONE, respond_buffer(iopad::RUN, ""));
+  });
+}
+
+void gadget::procRun(std::string_view name, uint64_t hash,
+                     const std::string &obuff) {
+  auto object = decoded_.take(hash);
+  if (!object) {
+    object = createObject(name, obuff);
+    if (object && object->valid() && decoded_.budget())
+      object->snapshot();
+  }
+  if (object) {
+    // the object with a failure state isn't reused
+    if (exec_object(object, 1, nullptr) == 0 && decoded_.budget())
+      decoded_.put(hash, object);
+  }
+}
+
+std::shared_ptr<Object> gadget::createObject(std::string_view name,
+                                             const std::string &obuff) {
+  // the object is relocated in place, keep the cached payload untouched
+  auto membuf = llvm::MemoryBuffer::getMemBufferCopy(obuff, name);
   llvm::file_magic magic = llvm::identify_magic(membuf->getBuffer());
   std::shared_ptr<Object> object;
   using fm = llvm::file_magic;
@@ -279,13 +697,9 @@ void gadget::procRun(std::string_view name, const std::string &obuff) {
   default:
     log_print(Runtime, "Unknown object payload, magic: {:16x}.",
               *reinterpret_cast<const uint64_t *>(obuff.data()));
-    return;
+    break;
   }
-  exec_object(object);
-
-  // notify clients the execution finished
-  for (auto &s : clients_)
-    send_respose(s.get(), iopad::RUN, "");
+  return object;
 }
 
 int gadget_printf(const char *format, ...) {
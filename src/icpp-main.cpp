@@ -12,6 +12,7 @@
 #include "platform.h"
 #include "runcfg.h"
 #include "runtime.h"
+#include "trace.h"
 #include "llvm/Support/InitLLVM.h"
 #include <format>
 #include <span>
@@ -62,6 +63,9 @@ static void print_help() {
       << "  -p/path/to/json: professional json configuration file for "
          "trace/profile/plugin/etc.."
       << std::endl
+      << "  --trace=/path/to/trace: print the execution trace file recorded "
+         "with the \"vm_trace\" configuration."
+      << std::endl
       << "FILES: input file can be C++ source code(.c/.cc/.cpp/.cxx), "
          "MachO/ELF/PE executable."
       << std::endl
@@ -186,6 +190,11 @@ extern "C" __ICPP_EXPORT__ int icpp_main(int argc, char **argv) {
       // continuing let clang print its help list
       return icpp::compile_source_clang(argc, const_cast<const char **>(argv));
     }
+    if (arg.starts_with("--trace=")) {
+      icpp::RunConfig::inst(argv[0], "");
+      // decode the trace file offline
+      return icpp::trace_decode(arg.substr(arg.find('=') + 1));
+    }
     if (arg == "-c" || arg == "-o") {
       icpp::RunConfig::inst(argv[0], "");
       // let icpp clang wrapper do the compilation task directly
@@ -328,6 +337,6 @@ extern "C" __ICPP_EXPORT__ int icpp_main(int argc, char **argv) {
   icpp::Loader::deinitialize(exitcode);
   // remove the temporary intermediate object file
   for (auto &opath : tmpofs)
-    fs::remove(opath);
+    icpp::remove_object(opath);
   return exitcode;
 }
@@ -60,6 +60,10 @@ static cl::opt<std::string> CreatePackage(
     "create",
     cl::desc("Create an icpp package from a json configuration file."),
     cl::cat(IModCat));
+static cl::opt<std::string> HashDirectory(
+    "hash",
+    cl::desc("Create the symbol.hash index of the libraries in a directory."),
+    cl::cat(IModCat));
 static cl::opt<bool> ListModule("list",
                                 cl::desc("List all the installed modules."),
                                 cl::init(false), cl::cat(IModCat));
@@ -73,9 +77,18 @@ static void print_version(llvm::raw_ostream &os) {
 // Don't need these implementations at all in imod tool
 namespace icpp {
 void init_library(std::shared_ptr<icpp::Object>) {}
+uint32_t exec_call_type(const void *) { return RCALL_UNKNOWN; }
 ObjectDisassembler::~ObjectDisassembler() {}
 void ObjectDisassembler::init(CObjectFile *, std::string_view) {}
-void Object::decodeInsns(TextSection &) {}
+void Object::decodeInsns() {}
+bool Object::initLazily(std::span<const IObjText>, std::span<const uint32_t>) {
+  return false;
+}
+void Object::decodeLazily(size_t, uint64_t) {}
+void Object::compactInsns(std::vector<IObjText> &, std::vector<uint32_t> &,
+                          std::vector<InsnInfo> &, std::vector<uint32_t> &,
+                          std::string &, std::vector<uint32_t> &) {}
+void Object::buildSuperblocks() {}
 void Object::parseSections(void) {}
 extern "C" void exec_engine_main(StubContext *ctx, ContextICPP *regs) {}
 int exec_main(std::string_view path, const std::vector<std::string> &deps,
@@ -351,6 +364,14 @@ static void create_package(const char *program, std::string_view cfgpath) {
   }
 }
 
+// merge the symbols of all the installed modules into symbol.index
+static bool build_index() {
+  std::string message;
+  auto ok = Rtlib::inst().buildIndex(message);
+  icpp::log_print(ok ? prefix_prog : prefix_error, "{}", message);
+  return ok;
+}
+
 static void install_package(const char *program, std::string_view pkgpath) {
   auto expBuff = llvm::MemoryBuffer::getFile(pkgpath.data());
   if (!expBuff) {
@@ -403,6 +424,8 @@ static void install_package(const char *program, std::string_view pkgpath) {
   // <libname, symbol hash array>
   SymbolHash symhash;
   auto allhashes = symhash.mutable_hashes();
+  // <libname, symbol names>
+  auto allnames = symhash.mutable_names();
   for (auto &file : pkg.files()) {
     auto fullpath = repo / file.path();
     auto parent = fullpath.parent_path();
@@ -448,10 +471,10 @@ static void install_package(const char *program, std::string_view pkgpath) {
 
         icpp::log_print(prefix_prog, "Parsing the symbols of {}...",
                         file.path());
-        std::string message;
+        std::string message, names;
         icpp::SymbolHash hasher(objfile);
         // parse and calculate the symbol hash array
-        auto hashes = hasher.hashes(message);
+        auto hashes = hasher.hashes(message, &names);
         if (message.size()) {
           icpp::log_print(prefix_error, "{}", message);
           return;
@@ -466,15 +489,16 @@ static void install_package(const char *program, std::string_view pkgpath) {
         allhashes->insert(
             {name, std::string(reinterpret_cast<char *>(&hashes[0]),
                                sizeof(hashes[0]) * hashes.size())});
+        allnames->insert({name, names});
       }
       continue;
     }
 
     icpp::log_print(prefix_prog, "Parsing the symbols of {}...", file.path());
-    std::string message;
+    std::string message, names;
     icpp::SymbolHash hasher(fullpath.string());
     // parse and calculate the symbol hash array
-    auto hashes = hasher.hashes(message);
+    auto hashes = hasher.hashes(message, &names);
     if (message.size()) {
       icpp::log_print(prefix_error, "{}", message);
       return;
@@ -489,6 +513,7 @@ static void install_package(const char *program, std::string_view pkgpath) {
                     name);
     allhashes->insert({name, std::string(reinterpret_cast<char *>(&hashes[0]),
                                          sizeof(hashes[0]) * hashes.size())});
+    allnames->insert({name, names});
   }
 
   // make sure the symbol.hash file at least contains 1 item
@@ -508,8 +533,11 @@ static void install_package(const char *program, std::string_view pkgpath) {
     return;
   }
   symhash.SerializePartialToOstream(&outf);
-  icpp::log_print(prefix_prog, "Created {}.\n + Successfully installed {}.",
-                  hashfile, pkg.name());
+  outf.close();
+  icpp::log_print(prefix_prog, "Created {}.", hashfile);
+  if (!build_index())
+    return;
+  icpp::log_print(prefix_pack, "Successfully installed {}.", pkg.name());
 }
 
 static void uninstall_module(std::string_view name) {
@@ -536,6 +564,45 @@ static void uninstall_module(std::string_view name) {
     return;
   }
   icpp::log_print(prefix_prog, "Uninstalled module {}.", name.data());
+  build_index();
+}
+
+static void hash_directory(std::string_view dir) {
+  // <library relative path, symbol hash array>
+  SymbolHash symhash;
+  auto allhashes = symhash.mutable_hashes();
+  for (auto &entry : fs::recursive_directory_iterator(dir)) {
+    auto name = entry.path().filename().string();
+    if (!entry.is_regular_file() || entry.is_symlink() ||
+        name.find(LLVM_PLUGIN_EXT) == std::string::npos)
+      continue;
+
+    std::string message;
+    icpp::SymbolHash hasher(entry.path().string());
+    // parse and calculate the symbol hash array
+    auto hashes = hasher.hashes(message);
+    if (message.size()) {
+      icpp::log_print(prefix_error, "{}", message);
+      continue;
+    }
+    auto relpath = fs::relative(entry.path(), dir).generic_string();
+    icpp::log_print(prefix_prog, "Parsed {} symbols in {}.", hashes.size(),
+                    relpath);
+    if (hashes.size())
+      allhashes->insert(
+          {relpath, std::string(reinterpret_cast<char *>(&hashes[0]),
+                                sizeof(hashes[0]) * hashes.size())});
+  }
+
+  auto hashfile = (fs::path(dir) / Rtlib::inst().hashFile).string();
+  std::ofstream outf(hashfile, std::ios::binary);
+  if (!outf.is_open()) {
+    icpp::log_print(prefix_error, "Failed to create {}.", hashfile);
+    return;
+  }
+  symhash.SerializePartialToOstream(&outf);
+  icpp::log_print(prefix_prog, "Created {} with {} libraries.", hashfile,
+                  allhashes->size());
 }
 
 static void list_module() {
@@ -568,6 +635,8 @@ int main(int argc, char **argv) {
     uninstall_module(UninstallModule);
   if (ListModule)
     list_module();
+  if (HashDirectory.length())
+    hash_directory(HashDirectory);
 
   return 0;
 }
@@ -9,12 +9,14 @@
 #include "platform.h"
 #include "runcfg.h"
 #include "utils.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/InitLLVM.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/SystemUtils.h"
 #include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/xxhash.h"
 #ifdef ON_WINDOWS
 #include <boost/process.hpp>
 #else
@@ -24,6 +26,7 @@
 #pragma clang diagnostic pop
 #endif
 #include <boost/asio.hpp>
+#include <brotli/encode.h>
 #include <filesystem>
 #include <fstream>
 #include <icpppad.pb.h>
@@ -57,6 +60,11 @@ static cl::opt<bool> Repl(
     cl::desc("Enter into a REPL interactive shell to fire the input snippet "
              "code to the connected remote icpp-gadget to execute it."),
     cl::init(false), cl::cat(IOPad));
+static cl::opt<bool>
+    Stats("stats",
+          cl::desc("Print the decoded object cache statistics of the "
+                   "connected remote icpp-gadget."),
+          cl::init(false), cl::cat(IOPad));
 static cl::opt<std::string>
     NDK("ndk",
         cl::desc("Set the Android NDK root path, default to the parent "
@@ -78,6 +86,11 @@ struct LaunchPad {
   icpp::CondMutex itc_;
   icpp::ArchType remote_arch_ = icpp::Unsupported;
   icpp::SystemType remote_system_;
+  // the protocol revision of icpp-gadget and the hashes of its cached objects
+  uint32_t remote_revision_ = 0;
+  std::set<uint64_t> remote_objects_;
+  // whether the object of the last RUNHASH is missing in icpp-gadget
+  bool missing_ = false;
   asio::io_service ios_;
   ip::tcp::socket socket_;
   std::string ndk_;
@@ -219,12 +232,7 @@ struct LaunchPad {
   }
 
   void send(iopad::CommandID id, const std::string &cmd) {
-    std::string buff;
-    buff.resize(sizeof(icpp::ProtocolHdr) + cmd.length());
-    auto hdr = reinterpret_cast<icpp::ProtocolHdr *>(buff.data());
-    hdr->cmd = id;
-    hdr->len = static_cast<uint32_t>(cmd.length());
-    std::memcpy(&hdr[1], cmd.data(), cmd.length());
+    auto buff = icpp::protocol_frame(id, cmd);
 
     boost::system::error_code error;
     asio::write(socket_, asio::buffer(buff), error);
@@ -234,6 +242,62 @@ struct LaunchPad {
     }
   }
 
+  // send the object to icpp-gadget to execute it, the cached one is run by
+  // its hash and the missing one is sent compressed
+  void run(const std::string &name, llvm::StringRef obuff) {
+    auto hash = llvm::xxh3_64bits(llvm::arrayRefFromStringRef(obuff));
+    if (remote_revision_ && remote_objects_.contains(hash)) {
+      iopad::CommandRunHash cmd;
+      cmd.set_name(name);
+      cmd.set_hash(hash);
+      missing_ = false;
+      send(iopad::RUNHASH, cmd.SerializeAsString());
+      // wait until the remote execution to be finished
+      wait();
+      if (!missing_)
+        return;
+      // evicted by icpp-gadget, send it again
+      remote_objects_.erase(hash);
+    }
+
+    iopad::CommandRun cmd;
+    cmd.set_name(name);
+    if (remote_revision_) {
+      cmd.set_hash(hash);
+      auto compsz = BrotliEncoderMaxCompressedSize(obuff.size());
+      std::string compbuff(compsz, 0);
+      // a moderate quality as it's compressed at each firing of a new object
+      if (BrotliEncoderCompress(
+              5, BROTLI_DEFAULT_WINDOW, BROTLI_DEFAULT_MODE, obuff.size(),
+              reinterpret_cast<const uint8_t *>(obuff.data()), &compsz,
+              reinterpret_cast<uint8_t *>(compbuff.data())) &&
+          compsz < obuff.size()) {
+        compbuff.resize(compsz);
+        cmd.set_buff(std::move(compbuff));
+        cmd.set_size(obuff.size());
+      } else {
+        cmd.set_buff(obuff.str());
+      }
+      remote_objects_.insert(hash);
+    } else {
+      cmd.set_buff(obuff.str());
+    }
+    send(iopad::RUN, cmd.SerializeAsString());
+    // wait until the remote execution to be finished
+    wait();
+  }
+
+  void stats() {
+    if (remote_revision_ < 2) {
+      icpp::log_print(icpp::Runtime, "The remote icpp-gadget is too old to "
+                                     "report the statistics.");
+      return;
+    }
+    send(iopad::STATS, "");
+    // wait until the statistics to be printed
+    wait();
+  }
+
   bool recv() {
     while (running_) {
       boost::system::error_code error;
@@ -255,9 +319,24 @@ struct LaunchPad {
       if (!hdr->len) {
         continue;
       }
+      uint64_t bodylen;
+      if (!icpp::protocol_body_length(
+              hdr,
+              [&](void *buff, size_t size) {
+                asio::read(socket_, asio::buffer(buff, size), error);
+                return !error;
+              },
+              bodylen)) {
+        // either failed to read it or it exceeds the limit
+        icpp::log_print(icpp::Develop,
+                        "Invalid body length of cmd.{}.\nClosed connection.",
+                        hdr->cmd);
+        disconnect();
+        return false;
+      }
       // protocol body serialized by protobuf
       asio::streambuf probuffer;
-      asio::read(socket_, probuffer, asio::transfer_exactly(hdr->len), error);
+      asio::read(socket_, probuffer, asio::transfer_exactly(bodylen), error);
       if (error && error != asio::error::eof) {
         icpp::log_print(icpp::Develop, "Failed to read body buffer: {}.",
                         error.message());
@@ -298,6 +377,8 @@ struct LaunchPad {
       }
       remote_arch_ = static_cast<icpp::ArchType>(resp.arch());
       remote_system_ = static_cast<icpp::SystemType>(resp.ostype());
+      remote_revision_ = resp.revision();
+      remote_objects_.insert(resp.objects().begin(), resp.objects().end());
       break;
     }
     case iopad::RESPONE: {
@@ -307,10 +388,26 @@ struct LaunchPad {
                         hdr->cmd, size);
         break;
       }
+      if (resp.cmd() == iopad::STATS) {
+        iopad::CacheStats stats;
+        if (stats.ParseFromString(resp.result()))
+          std::cout << std::format(
+              "Decoded object cache: {} hits, {} misses, {} evictions, {} "
+              "objects using {:.1f}/{}MB.\n",
+              stats.hits(), stats.misses(), stats.evictions(), stats.count(),
+              stats.usage() / 1024.0 / 1024.0, stats.budget() / 1024 / 1024);
+        itc_.signal();
+        break;
+      }
       if (resp.result().length())
         std::cout << resp.result();
 
       switch (resp.cmd()) {
+      case iopad::RUNHASH:
+        // the object isn't cached, let main thread send it
+        missing_ = true;
+        itc_.signal();
+        break;
       case iopad::RUN:
         // notify main thread to continue
         itc_.signal();
@@ -369,16 +466,10 @@ static void exec_code(std::string_view icpp, std::string_view code) {
     return;
 
   // send to icpp-gadget to execute this object payload
-  iopad::CommandRun cmd;
-  cmd.set_name(fs::path(srcpath).filename().string());
   auto expBuff = llvm::MemoryBuffer::getFile(objpath);
-  if (expBuff) {
-    auto buff = expBuff.get().get();
-    cmd.set_buff(std::string(buff->getBufferStart(), buff->getBufferSize()));
-    launchpad.send(iopad::RUN, cmd.SerializeAsString());
-    // wait until the remote execution to be finished
-    launchpad.wait();
-  }
+  if (expBuff)
+    launchpad.run(fs::path(srcpath).filename().string(),
+                  expBuff.get()->getBuffer());
 
   if (snippet)
     fs::remove(srcpath);
@@ -433,7 +524,9 @@ int main(int argc, char **argv) {
                       Fire.data());
     }
   }
-  if (!Fire.length() || Repl) {
+  if (Stats)
+    run_launch_pad(false, []() { launchpad.stats(); });
+  if ((!Fire.length() && !Stats) || Repl) {
     run_launch_pad(true, [&icppexe]() { exec_repl(icppexe.c_str()); });
   }
 
@@ -21,6 +21,30 @@ namespace icpp {
 
 int exec_string(const char *argv0, std::string_view snippet, bool whole,
                 int argc, const char **argv) {
+  std::string source;
+  if (whole)
+    source = snippet;
+  else
+    source = std::format("#include <icpp.hpp>\nint main(void) {{{};return 0;}}",
+                         snippet);
+  int iargc = 1;
+  const char **iarg = &argv0;
+  if (argc) {
+    iargc = argc;
+    iarg = argv;
+  }
+
+  // compile in memory with the warm in-process compiler
+  std::shared_ptr<Object> object;
+  uint64_t key;
+  if (compile_snippet(argv0, source, object, key)) {
+    if (!object)
+      return -1; // clang has printed the error message
+    auto exitcode = exec_object(object, iargc, iarg);
+    cache_snippet(key, object, exitcode == 0);
+    return exitcode;
+  }
+
   // construct a temporary source path
   auto srcpath = fs::temp_directory_path() / icpp::rand_filename(8, ".cc");
   std::ofstream outf(srcpath);
@@ -29,11 +53,7 @@ int exec_string(const char *argv0, std::string_view snippet, bool whole,
               srcpath.string());
     return -1;
   }
-  if (whole)
-    outf << snippet.data();
-  else
-    outf << "#include <icpp.hpp>\nint main(void) {" << snippet.data()
-         << ";return 0;}";
+  outf << source;
   outf.close();
 
   std::vector<const char *> incs;
@@ -42,16 +62,10 @@ int exec_string(const char *argv0, std::string_view snippet, bool whole,
     return -1; // clang has printed the error message
 
   std::vector<std::string> deps;
-  int iargc = 1;
-  const char **iarg = &argv0;
-  if (argc) {
-    iargc = argc;
-    iarg = argv;
-  }
   bool validcache;
   int exitcode = exec_main(opath.string(), deps, srcpath.string(), iargc,
                            const_cast<char **>(iarg), validcache);
-  fs::remove(opath);
+  remove_object(opath);
   return exitcode;
 }
 
@@ -76,7 +90,7 @@ int exec_source(const char *argv0, std::string_view path, int argc,
                                  const_cast<char **>(iarg), validcache);
       if (opath.extension() != icpp::iobj_ext) {
         // remove the temporary intermediate object file
-        fs::remove(opath);
+        remove_object(opath);
         // done
         break;
       } else if (validcache) {
@@ -12,15 +12,18 @@
 #include "platform.h"
 #include "runcfg.h"
 #include "runtime.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdio>
 #include <iostream>
 #include <llvm/Config/config.h>
 #include <locale>
 #include <map>
 #include <mutex>
+#include <set>
 #include <stdio.h>
 #include <thread>
-#include <unordered_map>
 
 extern "C" {
 #if __linux__
@@ -80,8 +83,206 @@ libcpp_thread_create_t libcpp_thread_create = nullptr;
 
 static void nop_function(void) {}
 
+/*
+concurrent symbol cache, the lookup is lock-free and the insertion is
+serialized by the lock of the shard which the symbol name hashes to.
+
+the cached nodes are never released or moved until the loader is destroyed,
+so the value slot address can be returned as the data symbol pointer.
+*/
+class SymbolCache {
+public:
+  ~SymbolCache() {
+    for (auto &s : shards_) {
+      for (auto &b : s.buckets) {
+        for (auto n = b.load(std::memory_order_relaxed); n;) {
+          auto next = n->next;
+          delete n;
+          n = next;
+        }
+      }
+    }
+  }
+
+  // the value slot of the symbol, nullptr if it isn't cached, a found one is
+  // counted as a hit of its shard if hit is true
+  const void **find(std::string_view name, bool hit = false) {
+    auto hash = std::hash<std::string_view>{}(name);
+    auto &shard = shards_[hash % shard_count];
+    for (auto n = bucket(hash).load(std::memory_order_acquire); n;
+         n = n->next) {
+      if (n->hash == hash && n->name == name) {
+        if (hit)
+          shard.hits.fetch_add(1, std::memory_order_relaxed);
+        return &n->value;
+      }
+    }
+    return nullptr;
+  }
+
+  // the sum of the shard hits
+  uint64_t hits() {
+    uint64_t sum = 0;
+    for (auto &s : shards_)
+      sum += s.hits.load(std::memory_order_relaxed);
+    return sum;
+  }
+
+  // cache the symbol if it's missing, return the value slot of it
+  const void **insert(std::string_view name, const void *value) {
+    auto hash = std::hash<std::string_view>{}(name);
+    auto &head = bucket(hash);
+    std::lock_guard lock(shards_[hash % shard_count].mutex);
+    auto first = head.load(std::memory_order_relaxed);
+    for (auto n = first; n; n = n->next) {
+      if (n->hash == hash && n->name == name)
+        return &n->value;
+    }
+    auto node = new Node{hash, std::string(name), value, first};
+    head.store(node, std::memory_order_release);
+    return &node->value;
+  }
+
+  const void **insert(const std::pair<std::string_view, const void *> &sym) {
+    return insert(sym.first, sym.second);
+  }
+
+private:
+  static constexpr size_t shard_count = 32;
+  static constexpr size_t bucket_count = 512;
+
+  struct Node {
+    size_t hash;
+    std::string name;
+    const void *value;
+    Node *next;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    std::atomic<Node *> buckets[bucket_count]{};
+    // counted per shard so that the lookups don't contend on one counter, and
+    // in its own cache line so that it doesn't bounce the mutex and buckets
+    alignas(64) std::atomic<uint64_t> hits{0};
+  };
+
+  std::atomic<Node *> &bucket(size_t hash) {
+    return shards_[hash % shard_count]
+        .buckets[(hash / shard_count) % bucket_count];
+  }
+
+  Shard shards_[shard_count];
+};
+
+/*
+sorted address index of the loaded modules, a new immutable one is published
+whenever the module list changes, so that the readers search it lock-free.
+*/
+struct AddressIndex {
+  struct Entry {
+    uint64_t start;
+    uint64_t end;
+    Object *object;
+  };
+
+  // iobject text sections
+  std::vector<Entry> texts;
+  // iobject memory buffers, including the dynamic sections
+  std::vector<Entry> buffers;
+  // native module base and path
+  std::vector<std::pair<uint64_t, std::string>> natives;
+
+  static const Entry *search(const std::vector<Entry> &ranges, uint64_t vm) {
+    auto it = std::upper_bound(
+        ranges.begin(), ranges.end(), vm,
+        [](uint64_t vm, const Entry &e) { return vm < e.start; });
+    if (it == ranges.begin() || vm >= (--it)->end)
+      return nullptr;
+    return &*it;
+  }
+
+  const std::string *native(uint64_t vm) const {
+    auto it = std::upper_bound(
+        natives.begin(), natives.end(), vm,
+        [](uint64_t vm, const auto &m) { return vm < m.first; });
+    // if vm is between base0 and base1, we think it belongs to base0
+    return it == natives.begin() ? nullptr : &(--it)->second;
+  }
+};
+
+/*
+hazard slot of a thread, it holds the address index being searched so that
+the replaced one isn't freed under the reader. the slots are never freed,
+the ones of the exited threads are reused by the new threads.
+*/
+struct IndexHazard {
+  std::atomic<const AddressIndex *> index{nullptr};
+  std::atomic<bool> used{false};
+  IndexHazard *next = nullptr;
+};
+
+static std::atomic<IndexHazard *> index_hazards{nullptr};
+
+static IndexHazard *index_hazard() {
+  struct Holder {
+    Holder() {
+      for (auto h = index_hazards.load(std::memory_order_acquire); h;
+           h = h->next) {
+        bool unused = false;
+        if (h->used.compare_exchange_strong(unused, true)) {
+          hazard = h;
+          return;
+        }
+      }
+      hazard = new IndexHazard;
+      hazard->used = true;
+      hazard->next = index_hazards.load(std::memory_order_relaxed);
+      while (!index_hazards.compare_exchange_weak(hazard->next, hazard,
+                                                  std::memory_order_release,
+                                                  std::memory_order_relaxed))
+        ;
+    }
+    ~Holder() {
+      hazard->index.store(nullptr, std::memory_order_release);
+      hazard->used.store(false, std::memory_order_release);
+    }
+
+    IndexHazard *hazard;
+  };
+  thread_local Holder holder;
+  return holder.hazard;
+}
+
+// pin the current address index in the hazard slot of this thread while
+// searching it, the nested pins restore the outer one
+class PinnedIndex {
+public:
+  PinnedIndex(const std::atomic<const AddressIndex *> &current)
+      : hazard_(index_hazard()),
+        outer_(hazard_->index.load(std::memory_order_relaxed)) {
+    pinned_ = current.load(std::memory_order_acquire);
+    while (true) {
+      hazard_->index.store(pinned_);
+      // make sure it's still the current one after being pinned
+      auto latest = current.load();
+      if (latest == pinned_)
+        break;
+      pinned_ = latest;
+    }
+  }
+  ~PinnedIndex() { hazard_->index.store(outer_, std::memory_order_release); }
+
+  const AddressIndex *operator->() const { return pinned_; }
+
+private:
+  IndexHazard *hazard_;
+  const AddressIndex *outer_;
+  const AddressIndex *pinned_;
+};
+
 struct ModuleLoader {
   ModuleLoader() : mainid_(std::this_thread::get_id()) {
+    updateIndex();
     // these symbols are extern in object but finally linked in exe/lib,
     // or
     // they have a different signature between the host and clang libc++.
@@ -326,16 +527,23 @@ struct ModuleLoader {
     // generate the iobject module cache if everything went well
     if (!exitcode) {
       for (auto io : imods_) {
-        if (io->isCache())
+        if (io->isCache() && !io->cacheOutdated())
           continue;
         io->generateCache();
       }
     }
     imods_.clear();
+    updateIndex();
   }
 
   void cacheSymbol(std::string_view name, const void *impl) {
-    syms_.insert({name.data(), impl});
+    syms_.insert(name, impl);
+  }
+
+  Loader::SymbolStats symbolStats() {
+    return {syms_.hits(),
+            misses_.load(std::memory_order_relaxed),
+            nanoseconds_.load(std::memory_order_relaxed)};
   }
 
   bool isMain() { return mainid_ == std::this_thread::get_id(); }
@@ -360,31 +568,38 @@ struct ModuleLoader {
   const void *resolve(const void *handle, std::string_view name, bool data);
   const void *resolve(std::string_view name, bool data);
   std::string find(const void *addr, bool update);
+  uint64_t moduleBase(std::string_view path);
 
   // it'll be invoked by execute engine when loaded a iobject module
   void cacheObject(std::shared_ptr<Object> imod);
 
   bool executable(uint64_t vm, Object **iobject) {
-    for (auto m : imods_) {
-      if (m->executable(vm, nullptr)) {
-        iobject[0] = m.get();
-        return true;
-      }
-    }
-    return false;
+    PinnedIndex index(index_);
+    auto found = AddressIndex::search(index->texts, vm);
+    if (!found)
+      return false;
+    iobject[0] = found->object;
+    return true;
   }
 
   bool belong(uint64_t vm) {
-    for (auto m : imods_) {
-      if (m->belong(vm))
-        return true;
-    }
-    return false;
+    PinnedIndex index(index_);
+    return AddressIndex::search(index->buffers, vm) != nullptr;
   }
 
 private:
-  const void *resolveInCache(std::string_view name, bool data);
+  const void *resolveInCache(std::string_view name, bool data,
+                             bool hit = false);
   const void *lookup(std::string_view name, bool data);
+  // rebuild and publish the address index from imods_ and mods_
+  void updateIndex();
+  // the same as updateIndex with indexmutex_ already held
+  void rebuildIndex();
+  // search the symbol in the module of handle and cache it
+  const void *searchModule(const void *handle, std::string_view name,
+                           bool data);
+  // load all the bundled boost libraries if they aren't indexed
+  void loadBoost();
 #if __linux__
   friend int iter_so_callback(dl_phdr_info *info, size_t size, void *data);
 #endif
@@ -393,14 +608,25 @@ private:
   std::recursive_mutex mutex_;
 
   // cached symbols
-  std::unordered_map<std::string, const void *> syms_;
+  SymbolCache syms_;
+  // resolution statistics
+  // the hits are counted by the cache shards
+  std::atomic<uint64_t> misses_{0}, nanoseconds_{0};
 
   // native modules
   std::map<uint64_t, std::string> mods_;
-  std::vector<std::map<uint64_t, std::string>::iterator> modits_;
+
+  // the current address index, the replaced ones are kept alive only while
+  // some readers are still pinning them
+  std::atomic<const AddressIndex *> index_;
+  std::vector<std::unique_ptr<AddressIndex>> indexes_;
+  // serializes the index rebuilds and the mods_ updates
+  std::mutex indexmutex_;
 
   // native module handles
   std::map<std::string, const void *> mhandles_;
+  // the indexed boost libraries which failed to load
+  std::set<std::string> boostfails_;
   std::vector<std::map<std::string, const void *>::iterator> mhandleits_;
 
   // iobject modules
@@ -431,6 +657,7 @@ const void *ModuleLoader::loadLibrary(std::string_view path) {
           // it'll call the Loader::cacheObject after executing the ctors
           init_library(object);
           imods_.push_back(object);
+          updateIndex();
           addr = object.get();
         }
       }
@@ -447,27 +674,44 @@ const void *ModuleLoader::loadLibrary(std::string_view path) {
   return found->second;
 }
 
-const void *ModuleLoader::resolveInCache(std::string_view name, bool data) {
-  auto found = syms_.find(name.data());
-  if (found == syms_.end())
+const void *ModuleLoader::resolveInCache(std::string_view name, bool data,
+                                         bool hit) {
+  auto found = syms_.find(name, hit);
+  if (!found)
     return nullptr;
   for (auto loc : global_locals) {
     // return the simulated global locals directly
-    if (found->second == loc)
+    if (*found == loc)
       return loc;
   }
   // return a second level pointer if applying data type symbol
-  return data ? &found->second : found->second;
+  return data ? found : *found;
+}
+
+static uint64_t resolve_now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
 }
 
 const void *ModuleLoader::resolve(const void *handle, std::string_view name,
                                   bool data) {
-  LockGuard lock(this, mutex_);
-
-  const void *target = resolveInCache(name, data);
+  const void *target = resolveInCache(name, data, true);
   if (target)
     return target;
 
+  misses_.fetch_add(1, std::memory_order_relaxed);
+  auto start = resolve_now();
+  LockGuard lock(this, mutex_);
+  target = searchModule(handle, name, data);
+  nanoseconds_.fetch_add(resolve_now() - start, std::memory_order_relaxed);
+  return target;
+}
+
+const void *ModuleLoader::searchModule(const void *handle,
+                                       std::string_view name, bool data) {
+  const void *target = nullptr;
+
   // check it in iobject modules
   for (auto io : imods_) {
     if (handle != io.get())
@@ -486,45 +730,81 @@ const void *ModuleLoader::resolve(const void *handle, std::string_view name,
 
   if (!target)
     return nullptr;
-  auto newit = syms_.insert({name.data(), target}).first;
-  return data ? &newit->second : newit->second;
+  auto slot = syms_.insert(name, target);
+  return data ? slot : *slot;
 }
 
 const void *ModuleLoader::resolve(std::string_view name, bool data) {
-  LockGuard lock(this, mutex_);
+  // the cached symbols are resolved without locking
+  const void *target = resolveInCache(name, data, true);
+  if (target)
+    return target;
 
-  const void *target = resolveInCache(name, data);
-  return target ? target : lookup(name, data);
+  misses_.fetch_add(1, std::memory_order_relaxed);
+  auto start = resolve_now();
+  {
+    LockGuard lock(this, mutex_);
+    // another thread may have resolved it while we were waiting for the lock
+    target = resolveInCache(name, data);
+    if (!target)
+      target = lookup(name, data);
+  }
+  nanoseconds_.fetch_add(resolve_now() - start, std::memory_order_relaxed);
+  return target;
+}
+
+// whether the boost library should be loaded after all the others, its static
+// initializers depend on them
+static bool boost_late(std::string_view name) {
+#if __linux__
+  return name.find("boost_log") != std::string_view::npos ||
+         name.find("boost_locale") != std::string_view::npos ||
+         name.find("boost_fiber_numa") != std::string_view::npos;
+#else
+  return false;
+#endif
+}
+
+void ModuleLoader::loadBoost() {
+  // load these libs in the end, otherwise failed loading
+  std::vector<std::string> lazylibs;
+  for (auto &entry :
+       fs::recursive_directory_iterator(RuntimeLib::inst().boostFull())) {
+    auto libpath = entry.path();
+    auto name = libpath.filename().string();
+    if (entry.is_regular_file() && !entry.is_symlink() &&
+        name.find(LLVM_PLUGIN_EXT) != std::string::npos) {
+      if (boost_late(name)) {
+        lazylibs.push_back(libpath.string());
+        continue;
+      }
+      loadLibrary(libpath.string());
+    }
+  }
+  for (auto &p : lazylibs)
+    loadLibrary(p);
 }
 
 const void *ModuleLoader::lookup(std::string_view name, bool data) {
   // load boost libraries lazily
   static bool boost = false;
   if (!boost && name.find("boost") != std::string_view::npos) {
-    boost = true;
-
-    // load these libs in the end, otherwise failed loading
-    std::vector<std::string> lazylibs;
-    for (auto &entry : fs::recursive_directory_iterator(
-             fs::absolute(RunConfig::inst()->program).parent_path() / ".." /
-             "lib" / "boost")) {
-      auto libpath = entry.path();
-      auto name = libpath.filename().string();
-      if (entry.is_regular_file() && !entry.is_symlink() &&
-          name.find(LLVM_PLUGIN_EXT) != std::string::npos) {
-#if __linux__
-        if (name.find("boost_log") != std::string::npos ||
-            name.find("boost_locale") != std::string::npos ||
-            name.find("boost_fiber_numa") != std::string::npos) {
-          lazylibs.push_back(libpath.string());
-          continue;
-        }
-#endif
-        loadLibrary(libpath.string());
+    if (!RuntimeLib::inst().boostIndexed()) {
+      boost = true;
+      loadBoost();
+    } else if (auto path = RuntimeLib::inst().findBoost(name); !path.empty()) {
+      // only load the library which defines this symbol if it's indexed
+      auto lib = path.string();
+      if (boost_late(path.filename().string())) {
+        // its dependencies must be initialized first, load all of them in
+        // order
+        boost = true;
+        loadBoost();
+      } else if (!boostfails_.contains(lib) && !loadLibrary(lib)) {
+        // don't retry it for each of its symbols
+        boostfails_.insert(lib);
       }
     }
-    for (auto &p : lazylibs)
-      loadLibrary(p);
   }
 
   const void *target = nullptr;
@@ -552,7 +832,7 @@ const void *ModuleLoader::lookup(std::string_view name, bool data) {
     auto path = RuntimeLib::inst().find(name);
     if (!path.empty()) {
       auto handle = loadLibrary(path.string());
-      target = resolve(handle, name, data);
+      target = searchModule(handle, name, data);
     }
     // Oops...
     if (!target) {
@@ -564,53 +844,78 @@ const void *ModuleLoader::lookup(std::string_view name, bool data) {
   }
 
   // cache it
-  auto newit = syms_.insert({name.data(), target}).first;
-  return data ? &newit->second : newit->second;
+  auto slot = syms_.insert(name, target);
+  return data ? slot : *slot;
+}
+
+void ModuleLoader::updateIndex() {
+  std::lock_guard lock(indexmutex_);
+  rebuildIndex();
+}
+
+void ModuleLoader::rebuildIndex() {
+  auto index = std::make_unique<AddressIndex>();
+  for (auto &m : imods_) {
+    for (auto &r : m->textRanges())
+      index->texts.push_back({r.start, r.end, m.get()});
+    for (auto &r : m->memoryRanges())
+      index->buffers.push_back({r.start, r.end, m.get()});
+  }
+  auto less = [](const AddressIndex::Entry &a, const AddressIndex::Entry &b) {
+    return a.start < b.start;
+  };
+  std::sort(index->texts.begin(), index->texts.end(), less);
+  std::sort(index->buffers.begin(), index->buffers.end(), less);
+  index->natives.assign(mods_.begin(), mods_.end());
+
+  const AddressIndex *current = index.get();
+  index_.store(current);
+  indexes_.push_back(std::move(index));
+  // free the replaced ones which no reader is pinning
+  std::set<const AddressIndex *> pinned{current};
+  for (auto h = index_hazards.load(std::memory_order_acquire); h; h = h->next)
+    pinned.insert(h->index.load());
+  std::erase_if(indexes_,
+                [&pinned](const auto &i) { return !pinned.contains(i.get()); });
 }
 
 std::string ModuleLoader::find(const void *addr, bool update) {
-  if (mods_.size() == 0 || update) {
+  if (update || PinnedIndex(index_)->natives.size() == 0) {
     LockGuard lock(this, mutex_);
+    std::lock_guard ilock(indexmutex_);
     iterate_modules([](uint64_t base, std::string_view path) {
       moloader->mods_.insert({base, path.data()});
       return false;
     });
-    // reset module iterators
-    modits_.clear();
-    for (auto it = mods_.begin(); it != mods_.end(); it++) {
-      modits_.push_back(it);
-    }
+    rebuildIndex();
   }
+  PinnedIndex index(index_);
+  auto vm = reinterpret_cast<uint64_t>(addr);
   // check it in iobject module
-  for (auto m : imods_) {
-    if (m->belong(reinterpret_cast<uint64_t>(addr))) {
-      return m->cachePath();
-    }
-  }
-  // binary search for the module
-  long low = 0;
-  long high = modits_.size() - 1;
-  auto target = reinterpret_cast<uint64_t>(addr);
-  while (low <= high) {
-    auto mid = (low + high) / 2;
-    if (mid + 1 == modits_.size()) {
-      return modits_[mid]->second.data();
-    }
-    auto base0 = modits_[mid]->first;
-    auto base1 = modits_[mid + 1]->first;
-    if (base0 <= target && target < base1) {
-      // if target is between base0 and base1, we think it belongs to base0
-      return modits_[mid]->second.data();
-    }
-    if (base0 > target) {
-      // back forward
-      high = mid - 1;
-    } else {
-      // go forward
-      low = mid + 1;
+  auto found = AddressIndex::search(index->buffers, vm);
+  if (found)
+    return found->object->cachePath();
+  // check it in native module
+  auto path = index->native(vm);
+  return path ? *path : "";
+}
+
+uint64_t ModuleLoader::moduleBase(std::string_view path) {
+  auto search = [this, path]() {
+    PinnedIndex index(index_);
+    for (auto &m : index->natives) {
+      if (m.second == path)
+        return m.first;
     }
+    return static_cast<uint64_t>(-1);
+  };
+  auto base = search();
+  if (base == static_cast<uint64_t>(-1)) {
+    // update the module list as it may be loaded after the last update
+    find(nullptr, true);
+    base = search();
   }
-  return "";
+  return base;
 }
 
 void ModuleLoader::cacheObject(std::shared_ptr<Object> imod) {
@@ -621,6 +926,7 @@ void ModuleLoader::cacheObject(std::shared_ptr<Object> imod) {
       mhandles_
           .insert({imod->path().data(), reinterpret_cast<void *>(imod.get())})
           .first);
+  updateIndex();
 }
 
 void Loader::initialize() {
@@ -631,6 +937,10 @@ void Loader::initialize() {
 void Loader::deinitialize(int exitcode) {
   if (!moloader)
     return;
+  auto stats = moloader->symbolStats();
+  log_print(Develop,
+            "Symbol resolution: {} hits, {} misses, {:.3f}ms spent in misses.",
+            stats.hits, stats.misses, stats.nanoseconds / 1000000.0);
   moloader->cacheAndClean(exitcode);
 }
 
@@ -661,6 +971,10 @@ std::string Loader::locateModule(const void *addr, bool update) {
   return moloader->find(addr, update);
 }
 
+uint64_t Loader::moduleBase(std::string_view path) {
+  return moloader->moduleBase(path);
+}
+
 void Loader::cacheObject(std::shared_ptr<Object> imod) {
   moloader->cacheObject(imod);
 }
@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <string_view>
@@ -17,6 +18,12 @@ class Object;
 
 class Loader {
 public:
+  struct SymbolStats {
+    uint64_t hits;        // resolved from the symbol cache
+    uint64_t misses;      // resolved by searching the modules
+    uint64_t nanoseconds; // time spent in resolving the missed ones
+  };
+
   Loader(Object *object, const std::vector<std::string> &deps);
   Loader(std::string_view module);
   ~Loader();
@@ -38,6 +45,9 @@ public:
   // locate the module path which the symbol belongs to
   static std::string locateModule(const void *addr, bool update = false);
 
+  // get the base address of the loaded native module, -1 if it's missing
+  static uint64_t moduleBase(std::string_view path);
+
   // cache the iobject module
   static void cacheObject(std::shared_ptr<Object> imod);
 
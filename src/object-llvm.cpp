@@ -88,14 +88,20 @@
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Support/WithColor.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
 #include "llvm/TargetParser/Host.h"
 #include "llvm/TargetParser/Triple.h"
 #include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <chrono>
 #include <cstring>
+#include <mutex>
 #include <optional>
 #include <set>
 #include <system_error>
+#include <thread>
+#include <tuple>
 #include <unicorn/unicorn.h>
 #include <unordered_map>
 #include <utility>
@@ -245,6 +251,10 @@ public:
   DisassemblerTarget(DisassemblerTarget &Other, StringRef TripleName,
                      StringRef MCPU, SubtargetFeatures &Features);
 
+  // a new disassembler with its own context for the decoding thread
+  std::unique_ptr<MCDisassembler>
+  createDisassembler(std::unique_ptr<MCContext> &context);
+
 private:
   MCTargetOptions Options;
   std::shared_ptr<const MCRegisterInfo> RegisterInfo;
@@ -317,6 +327,15 @@ DisassemblerTarget::DisassemblerTarget(DisassemblerTarget &Other,
       RegisterInfo(Other.RegisterInfo), AsmInfo(Other.AsmInfo),
       InstrInfo(Other.InstrInfo), ObjectFileInfo(Other.ObjectFileInfo) {}
 
+std::unique_ptr<MCDisassembler>
+DisassemblerTarget::createDisassembler(std::unique_ptr<MCContext> &context) {
+  context = std::make_unique<MCContext>(Context->getTargetTriple(),
+                                        AsmInfo.get(), RegisterInfo.get(),
+                                        SubtargetInfo.get());
+  return std::unique_ptr<MCDisassembler>(
+      TheTarget->createMCDisassembler(*SubtargetInfo, *context));
+}
+
 void ObjectDisassembler::init(CObjectFile *Obj, std::string_view Triple) {
   std::string TripleName(Triple);
   const Target *TheTarget = getTarget(Obj, TripleName);
@@ -342,11 +361,6 @@ void ObjectDisassembler::init(CObjectFile *Obj, std::string_view Triple) {
   SP = new SourcePrinter(Obj, TheTarget->getName());
 }
 
-ObjectDisassembler::~ObjectDisassembler() {
-  delete DT;
-  delete SP;
-}
-
 std::string Object::sourceInfo(uint64_t vm) {
   uint64_t sindex = -1;
   uint64_t saddr = 0;
@@ -424,7 +438,6 @@ static uint16_t llvm2ucRegisterAArch64(unsigned reg) {
 }
 
 static void parseInstAArch64(const MCInst &inst, uint64_t opcptr,
-                             std::map<std::string, std::string> &decinfo,
                              InsnInfo &iinfo) {
   namespace INSN = llvm::AArch64;
   switch (inst.getOpcode()) {
@@ -677,9 +690,7 @@ static uint16_t llvm2ucRegisterX64(unsigned reg) {
   abort();
 }
 
-static void parseInstX64(MCInst &inst, uint64_t opcptr,
-                         std::map<std::string, std::string> &decinfo,
-                         InsnInfo &iinfo) {
+static void parseInstX64(MCInst &inst, uint64_t opcptr, InsnInfo &iinfo) {
 #define add_jcond_opr(cond)                                                    \
   if (iinfo.len > 5) {                                                         \
     inst.addOperand(MCOperand::createImm(CONDT_##cond));                       \
@@ -1326,30 +1337,542 @@ static bool prefix_inst(const MCInst &inst) {
 }
 #endif
 
-void Object::decodeInsns(TextSection &text) {
-  // load text relocation symbols
-  std::map<uint64_t, RelocSymbol> rsyms;
-  reloc_symbols(ofile_.get(), arch(), text, rsyms);
+// the decoding result of a text section range, the instruction indexes, meta
+// offsets and relocations are local to this chunk until it's merged
+struct DecodeChunk {
+  TextSection *text;
+  const std::map<uint64_t, RelocSymbol> *rsyms;
+  uint64_t start, end; // vm range to decode
+  uint64_t stop = 0;   // vm where the decoding actually stopped
+  std::vector<InsnInfo> iinfs;
+  std::vector<uint32_t> imetas;
+  std::string imetabuf;
+  // <meta offset, size> in imetabuf
+  std::unordered_map<uint32_t, uint32_t> metasizes;
+  // <instruction index, relocation symbol, symbol type>
+  std::vector<std::tuple<uint32_t, const RelocSymbol *, uint32_t>> relocs;
+  // [entry, end) of the functions to hash in this chunk
+  std::vector<std::pair<uint64_t, uint64_t>> funcs;
+  // the hashed functions, ibegin is the index in iinfs
+  std::vector<IObjFunction> ifuncs;
+  // the reusable functions decoded before, nullptr if there's none
+  const DecodeReuse *reuse = nullptr;
+};
+
+// the decoded functions of the previous .io cache, the unchanged ones are
+// reused rather than decoded again after recompiling the source
+struct DecodeReuse {
+  std::vector<IObjFunction> funcs;
+  std::vector<InsnInfo> insts;
+  std::vector<uint32_t> metas;
+  std::string metabuf;
+  // <content hash, function>
+  std::unordered_map<uint64_t, const IObjFunction *> hashes;
+  // <meta offset, size> in metabuf
+  std::unordered_map<uint32_t, uint32_t> metasizes;
+};
+
+static void load_reuse(std::string_view path, DecodeReuse &reuse) {
+  auto copy = []<typename T>(std::vector<T> &array, std::string sect) {
+    array.resize(sect.size() / sizeof(T));
+    std::memcpy(array.data(), sect.data(), array.size() * sizeof(T));
+  };
+  copy(reuse.funcs, iobj_section(path, IOBJ_FUNCTIONS));
+  if (reuse.funcs.empty())
+    return;
+  copy(reuse.insts, iobj_section(path, IOBJ_INSTINFOS));
+  copy(reuse.metas, iobj_section(path, IOBJ_INSTMETAS));
+  reuse.metabuf = iobj_section(path, IOBJ_METABUF);
+  if (reuse.metas.size() != reuse.insts.size())
+    return;
+  for (auto &f : reuse.funcs) {
+    if (uint64_t(f.ibegin) + f.icount <= reuse.insts.size())
+      reuse.hashes.insert({f.hash, &f});
+  }
+  // each meta data ends at the next one as they're stored in order
+  std::vector<uint32_t> offsets;
+  for (auto m : reuse.metas) {
+    if (m < reuse.metabuf.size())
+      offsets.push_back(m);
+  }
+  std::sort(offsets.begin(), offsets.end());
+  offsets.erase(std::unique(offsets.begin(), offsets.end()), offsets.end());
+  for (size_t i = 0; i < offsets.size(); i++) {
+    auto end = i + 1 < offsets.size() ? offsets[i + 1] : reuse.metabuf.size();
+    reuse.metasizes[offsets[i]] = static_cast<uint32_t>(end - offsets[i]);
+  }
+}
+
+// the states of decoding the instructions on demand
+struct LazyDecoder {
+  std::mutex mutex;
+  // the decoder of its own as the shared one may be used by the others
+  std::unique_ptr<MCContext> context;
+  std::unique_ptr<MCDisassembler> disasm;
+  // relocation symbols of each text section
+  std::vector<std::map<uint64_t, RelocSymbol>> rsyms;
+  // sorted function entries
+  std::vector<uint64_t> entries;
+  // instruction informations and meta offsets indexed by slot, only the pages
+  // of the decoded ones are backed
+  PagesTable<InsnInfo> insts;
+  PagesTable<uint32_t> metas;
+  // wide relocation indexes by slot, it's allocated on the first one
+  PagesTable<uint32_t> wides;
+  // <opcodes, meta offset> of the published instructions
+  std::unordered_map<std::string_view, uint32_t> metacache;
+  // <meta offset, size>
+  std::unordered_map<uint32_t, uint32_t> metasizes;
+  // meta data blocks and the used size of the last one
+  std::vector<std::unique_ptr<char[]>> blocks;
+  uint32_t used = lazy_block_size;
+
+  // append a meta data to the blocks, return its lazy meta offset
+  uint32_t append(const char **table, const char *data, uint32_t size) {
+    used = (used + 7) & ~7U;
+    if (used + size > lazy_block_size) {
+      if (blocks.size() == (1ULL << (32 - lazy_block_shift))) {
+        // never be here
+        log_print(Runtime, "Fatal error, the lazy meta blocks are exhausted.");
+        abort();
+      }
+      blocks.push_back(std::make_unique<char[]>(lazy_block_size));
+      table[blocks.size() - 1] = blocks.back().get();
+      used = 0;
+    }
+    auto offset =
+        static_cast<uint32_t>((blocks.size() - 1) << lazy_block_shift | used);
+    std::memcpy(blocks.back().get() + used, data, size);
+    used += size;
+    metasizes[offset] = size;
+    return offset;
+  }
+};
+
+ObjectDisassembler::~ObjectDisassembler() {
+  delete DT;
+  delete SP;
+  delete LD;
+}
+
+// the text sections are split into chunks of about this size at function
+// entries, each chunk is decoded by one of the decoding threads
+constexpr const uint64_t decode_chunk_size = 16 * 1024;
+
+// whether the text sections are within the range of InsnInfo::rva
+static bool rva_encodable(const std::vector<TextSection> &texts) {
+  for (auto &text : texts) {
+    if (text.frva + text.size > insn_rva_limit)
+      return false;
+  }
+  return true;
+}
+
+void Object::decodeInsns() {
+  if (!rva_encodable(textsects_)) {
+    log_print(Runtime, "The text sections of {} are too large to decode.",
+              path_);
+    arch_ = Unsupported;
+    return;
+  }
+  auto starttime = std::chrono::steady_clock::now();
+  ifuncs_.clear();
+  iwiderelocs_.clear();
+  std::vector<uint64_t> entries;
+  for (auto &f : funcs_)
+    entries.push_back(reinterpret_cast<uint64_t>(f.second));
+  std::sort(entries.begin(), entries.end());
+  entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+  // [entry, end) of the functions in the vm range
+  auto franges = [&entries](uint64_t start, uint64_t end) {
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+    auto it = std::lower_bound(entries.begin(), entries.end(), start);
+    for (; it != entries.end() && *it < end; it++)
+      ranges.push_back({*it, it + 1 != entries.end() && it[1] < end ? it[1]
+                                                                    : end});
+    return ranges;
+  };
+
+  // the unchanged functions of the stale .io cache are reused
+  DecodeReuse reuse;
+  load_reuse(cachePath(), reuse);
+
+  // load text relocation symbols and split the sections
+  std::vector<std::map<uint64_t, RelocSymbol>> rsyms(textsects_.size());
+  std::vector<std::vector<DecodeChunk>> chunks(textsects_.size());
+  std::vector<DecodeChunk *> tasks;
+  for (size_t i = 0; i < textsects_.size(); i++) {
+    auto &text = textsects_[i];
+    reloc_symbols(ofile_.get(), arch(), text, rsyms[i]);
+    auto end = text.vm + text.size;
+    auto it = entries.begin();
+    for (auto start = text.vm; start < end;) {
+      auto next = end;
+      it = std::lower_bound(it, entries.end(), start + decode_chunk_size);
+      if (it != entries.end() && *it < end)
+        next = *it;
+      chunks[i].push_back(DecodeChunk{&text, &rsyms[i], start, next});
+      chunks[i].back().funcs = franges(start, next);
+      chunks[i].back().reuse = &reuse;
+      start = next;
+    }
+  }
+  for (auto &sc : chunks) {
+    for (auto &c : sc)
+      tasks.push_back(&c);
+  }
+
+  // decode the chunks in parallel, each thread has its own disassembler as
+  // it isn't thread safe
+  auto workers = std::min<size_t>(std::thread::hardware_concurrency(),
+                                  tasks.size());
+  if (workers <= 1) {
+    for (auto c : tasks)
+      decodeChunk(*c, *odiser_.DT->DisAsm);
+  } else {
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < workers; w++) {
+      threads.emplace_back([this, &tasks, &next]() {
+        std::unique_ptr<MCContext> context;
+        auto disasm = odiser_.DT->createDisassembler(context);
+        for (size_t i; (i = next.fetch_add(1)) < tasks.size();)
+          decodeChunk(*tasks[i], *disasm);
+      });
+    }
+    for (auto &t : threads)
+      t.join();
+  }
+
+  // merge the chunks in order
+  MetaCache metas;
+  for (size_t i = 0; i < textsects_.size(); i++) {
+    auto &text = textsects_[i];
+    auto &sc = chunks[i];
+    for (size_t j = 0; j + 1 < sc.size(); j++) {
+      if (sc[j].stop != sc[j + 1].start) {
+        // a function entry isn't at the instruction boundary, e.g.: there's
+        // data in code, decode the whole section again
+        log_print(Develop, "Redecoding text section {} serially.", text.index);
+        DecodeChunk whole{&text, &rsyms[i], text.vm, text.vm + text.size};
+        whole.funcs = franges(whole.start, whole.end);
+        whole.reuse = &reuse;
+        decodeChunk(whole, *odiser_.DT->DisAsm);
+        sc.clear();
+        sc.push_back(std::move(whole));
+        break;
+      }
+    }
+    text.ibegin = static_cast<uint32_t>(iinfs_.size());
+    for (auto &c : sc)
+      mergeChunk(c, metas);
+    text.icount = static_cast<uint32_t>(iinfs_.size()) - text.ibegin;
+  }
+
+  if (reuse.hashes.size()) {
+    size_t reused = 0;
+    for (auto &f : ifuncs_)
+      reused += reuse.hashes.contains(f.hash);
+    log_print(Develop, "Reused {} of {} decoded functions.", reused,
+              ifuncs_.size());
+  }
+
+  log_print(Develop, "Decoded {} instructions with {} relocations in {}ms.",
+            iinfs_.size(), irelocs_.size(),
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - starttime)
+                .count());
+
+  insts_ = iinfs_;
+  metas_ = imetas_;
+  metabuf_ = imetabuf_;
+  if (iwiderelocs_.size()) {
+    log_print(Develop, "Using the wide relocation table for {} relocations.",
+              irelocs_.size());
+    iwiderelocs_.resize(iinfs_.size());
+    widerelocs_ = iwiderelocs_;
+  }
+  for (auto &s : textsects_)
+    indexInsns(s);
+  classifyRelocs();
+  buildSuperblocks();
+}
 
+void Object::mergeChunk(DecodeChunk &chunk, MetaCache &metas) {
+  auto &text = *chunk.text;
+  auto ibase = iinfs_.size();
+  for (size_t i = 0; i < chunk.iinfs.size(); i++) {
+    auto &iinfo = chunk.iinfs[i];
+    auto imeta = chunk.imetas[i];
+    if (imeta != imeta_none) {
+      // share the same meta data with the other chunks
+      auto opc = text.vm + iinfo.rva - text.frva;
+      auto opcodes = std::string_view(reinterpret_cast<char *>(opc), iinfo.len);
+      auto found = metas.find(opcodes);
+      if (found == metas.end()) {
+        // keep each meta data 8 bytes aligned
+        imetabuf_.resize((imetabuf_.size() + 7) & ~7ULL);
+        found = metas
+                    .insert({opcodes, static_cast<uint32_t>(imetabuf_.size())})
+                    .first;
+        imetabuf_.append(&chunk.imetabuf[imeta], chunk.metasizes[imeta]);
+      }
+      imeta = found->second;
+    }
+    iinfs_.push_back(iinfo);
+    imetas_.push_back(imeta);
+  }
+  for (auto &[index, rsym, symtype] : chunk.relocs) {
+    auto &iinfo = iinfs_[ibase + index];
+    // record its relocation index
+    setReloc(iinfo, ibase + index,
+             relocateInsn(text.vm + iinfo.rva - text.frva, rsym, symtype));
+  }
+  for (auto f : chunk.ifuncs) {
+    f.ibegin += static_cast<uint32_t>(ibase);
+    ifuncs_.push_back(f);
+  }
+}
+
+void Object::setReloc(InsnInfo &inst, size_t index, uint32_t reloc) {
+  inst.rflag = 1;
+  if (reloc < insn_reloc_wide) {
+    inst.reloc = reloc;
+    return;
+  }
+  inst.reloc = insn_reloc_wide;
+  if (lazy_) {
+    auto ld = odiser_.LD;
+    if (!ld->wides) {
+      ld->wides = pages_table<uint32_t>(insts_.size());
+      if (!ld->wides) {
+        log_print(Runtime, "Fatal error, failed to allocate the wide relocs.");
+        abort();
+      }
+      widerelocs_ = {ld->wides.get(), insts_.size()};
+    }
+    ld->wides[index] = reloc;
+    return;
+  }
+  if (iwiderelocs_.size() <= index)
+    iwiderelocs_.resize(index + 1);
+  iwiderelocs_[index] = reloc;
+}
+
+uint32_t Object::relocateInsn(uint64_t opc, const void *prsym,
+                              uint32_t symtype) {
+  auto &rsym = *reinterpret_cast<const RelocSymbol *>(prsym);
+  const void *rtaddr = nullptr;
+  if (rsym.sflags & SymbolRef::SF_Undefined) {
+    // an extern relocation
+    rtaddr = Loader::locateSymbol(rsym.name, symtype == SymbolRef::ST_Data);
+  } else {
+    // a local relocation
+    auto expSect = rsym.sym.getSection();
+    auto expAddr = rsym.sym.getAddress();
+    if (!expSect || !expAddr) {
+      // never be here
+      log_print(Runtime,
+                "Fatal error, the symbol section/address of '{}'.'{:x}' is "
+                "missing for "
+                "relocation.",
+                rsym.name.data(), vm2rva(opc));
+      abort();
+    }
+    bool dyn = false;
+    auto sectname = expSect.get()->getName();
+    if (!sectname) {
+      // never be here
+      log_print(Runtime,
+                "Fatal error, the section name is missing for relocation.");
+      abort();
+    }
+    auto symoff = expAddr.get() - expSect.get()->getAddress() + rsym.addend;
+    for (auto &ds : dynsects_) {
+      if (expSect.get()->getIndex() == ds.index) {
+        // dynamically allocated section
+        dyn = true;
+
+        rtaddr = reinterpret_cast<const void *>(ds.buffer.data() + symoff);
+        break;
+      }
+    }
+    if (!dyn) {
+      // inner section from file
+      auto expContent = expSect.get()->getContents();
+      if (!expContent) {
+        // never be here
+        log_print(Runtime,
+                  "Fatal error, the section content of '{}' is missing for "
+                  "relocation.",
+                  sectname->data());
+        abort();
+      }
+      rtaddr = reinterpret_cast<const void *>(expContent->data() + symoff);
+    }
+  }
+  // index the relocations added since the last call, e.g.: the imported ones
+  // of a .io cache, the first one wins if there're duplicated ones
+  for (; relocindexed_ < irelocs_.size(); relocindexed_++) {
+    auto &r = irelocs_[relocindexed_];
+    relocindex_.insert({{r.target, r.type},
+                        static_cast<uint32_t>(relocindexed_)});
+  }
+  // check the existed relocation
+  auto rit = irelocs_.end();
+  auto found = relocindex_.find({rtaddr, symtype});
+  if (found != relocindex_.end()) {
+    rit = irelocs_.begin() + found->second;
+    // fix it as a data relocation for coff object
+    if (arch_ == AArch64 && ofile_->isCOFF() &&
+        (rsym.sflags & SymbolRef::SF_Undefined)) {
+#undef IMAGE_REL_ARM64_PAGEOFFSET_12L
+      if (rsym.rtype ==
+          COFF::RelocationTypesARM64::IMAGE_REL_ARM64_PAGEOFFSET_12L) {
+        symtype = SymbolRef::ST_Data;
+        relocindex_.erase(found);
+        rit->target = Loader::locateSymbol(rsym.name, true);
+        rit->type = symtype;
+        relocindex_.insert({{rit->target, rit->type},
+                            static_cast<uint32_t>(rit - irelocs_.begin())});
+      }
+    }
+  }
+  if (rit == irelocs_.end()) {
+    // insert a new relocation record, it's indexed at the next call
+    rit = irelocs_.insert(irelocs_.end(),
+                          RelocInfo{rsym.name.data(), rtaddr, symtype});
+  }
+  if (0) {
+    log_print(Develop, "Relocated {:06x}.{} symbol {} at {}.",
+              vm2rva(opc), symtype == SymbolRef::ST_Data ? "data" : "func",
+              rit->name, rit->target);
+  }
+  return static_cast<uint32_t>(rit - irelocs_.begin());
+}
+
+void Object::decodeChunk(DecodeChunk &chunk, MCDisassembler &disasm) {
+  auto &text = *chunk.text;
+  auto &rsyms = *chunk.rsyms;
+  // <opcodes, meta offset> in this chunk
+  MetaCache metas;
   int skipsz = arch_ == AArch64 ? 4 : 1;
-  // decode instructions in text section
   MCInst inst;
-  for (auto opc = text.vm, opcend = text.vm + text.size; opc < opcend;) {
+  auto opc = chunk.start;
+
+  // check the relocation symbol of the instruction to append, it's resolved
+  // when merging as the symbol loader isn't thread safe, the instructions are
+  // appended in order so that the relocation cursor only moves forward
+  auto rcursor = rsyms.lower_bound(text.frva + chunk.start - text.vm);
+  auto relocate = [&](const InsnInfo &iinfo) {
+#if ARCH_ARM64
+    uint64_t rfirst = iinfo.rva;
+    uint64_t rlast = iinfo.rva;
+#else
+    // the relocation is at the operand after the first opcode byte
+    if (iinfo.len <= 4)
+      return;
+    uint64_t rfirst = iinfo.rva + 1;
+    uint64_t rlast = iinfo.rva + iinfo.len - 4;
+#endif
+    while (rcursor != rsyms.end() && rcursor->first < rfirst)
+      rcursor++;
+    if (rcursor == rsyms.end() || rcursor->first > rlast)
+      return;
+    auto &rsym = rcursor->second;
+    auto symtype = reloc_symtype(iinfo, arch(), type(), rsym);
+    chunk.relocs.push_back({static_cast<uint32_t>(chunk.iinfs.size()), &rsym,
+                            static_cast<uint32_t>(symtype)});
+  };
+
+  // append the instructions of the unchanged function decoded before, the
+  // relocations are checked again as they aren't part of the content
+  auto reuse = [&](const IObjFunction &func) {
+    if (!chunk.reuse)
+      return false;
+    auto &ru = *chunk.reuse;
+    auto found = ru.hashes.find(func.hash);
+    if (found == ru.hashes.end() || found->second->size != func.size)
+      return false;
+    auto &old = *found->second;
+    auto insts = std::span(ru.insts).subspan(old.ibegin, old.icount);
+    auto imetas = std::span(ru.metas).subspan(old.ibegin, old.icount);
+    for (auto m : imetas) {
+      if (m != imeta_none && !ru.metasizes.contains(m))
+        return false;
+    }
+    for (size_t i = 0; i < insts.size(); i++) {
+      auto iinfo = insts[i];
+      iinfo.rflag = 0;
+      iinfo.reloc = 0;
+      iinfo.rva = iinfo.rva - old.rva + func.rva;
+      uint32_t imeta = imeta_none;
+      if (imetas[i] != imeta_none) {
+        auto opcodes = std::string_view(
+            reinterpret_cast<char *>(text.vm + iinfo.rva - text.frva),
+            iinfo.len);
+        auto mfound = metas.find(opcodes);
+        if (mfound == metas.end()) {
+          auto &imetabuf = chunk.imetabuf;
+          // keep each meta data 8 bytes aligned
+          imetabuf.resize((imetabuf.size() + 7) & ~7ULL);
+          auto offset = static_cast<uint32_t>(imetabuf.size());
+          auto msize = ru.metasizes.at(imetas[i]);
+          imetabuf.append(&ru.metabuf[imetas[i]], msize);
+          chunk.metasizes[offset] = msize;
+          mfound = metas.insert({opcodes, offset}).first;
+        }
+        imeta = mfound->second;
+      }
+      if (iinfo.type != INSN_ABORT)
+        relocate(iinfo);
+      chunk.iinfs.push_back(iinfo);
+      chunk.imetas.push_back(imeta);
+    }
+    return true;
+  };
+
+  // the function being decoded, it's recorded if it ends at fend exactly
+  size_t fi = 0;
+  IObjFunction func{};
+  uint64_t fend = 0;
+  for (; opc < chunk.end;) {
+    while (fi < chunk.funcs.size() && chunk.funcs[fi].first < opc)
+      fi++;
+    if (fi < chunk.funcs.size() && chunk.funcs[fi].first == opc) {
+      fend = chunk.funcs[fi++].second;
+      auto fsize = fend - opc;
+      func = IObjFunction{
+          llvm::xxh3_64bits(
+              ArrayRef<uint8_t>(reinterpret_cast<const uint8_t *>(opc), fsize)),
+          static_cast<uint32_t>(text.frva + opc - text.vm),
+          static_cast<uint32_t>(fsize),
+          static_cast<uint32_t>(chunk.iinfs.size()), 0};
+      if (reuse(func)) {
+        func.icount = static_cast<uint32_t>(chunk.iinfs.size()) - func.ibegin;
+        chunk.ifuncs.push_back(func);
+        opc = fend;
+        fend = 0;
+        continue;
+      }
+    }
+
     uint64_t size = 0;
-    auto status = odiser_.DT->DisAsm->getInstruction(
+    auto status = disasm.getInstruction(
         inst, size, BuildIDRef(reinterpret_cast<const uint8_t *>(opc), 16), opc,
-        outs());
+        nulls());
     InsnInfo iinfo{};
     iinfo.rva = text.frva + opc - text.vm;
+    uint32_t imeta = imeta_none;
 
 #if ARCH_X64
     if (prefix_inst(inst)) {
       uint64_t size2 = 0;
       auto opc2 = opc + size;
       // reset inst to the real instruction informtion
-      status = odiser_.DT->DisAsm->getInstruction(
+      status = disasm.getInstruction(
           inst, size2, BuildIDRef(reinterpret_cast<const uint8_t *>(opc2), 16),
-          opc2, outs());
+          opc2, nulls());
       // the composite opcode size = prefix + inst
       size += size2;
     }
@@ -1373,156 +1896,347 @@ void Object::decodeInsns(TextSection &text) {
       if (arch() == AArch64) {
 #if ICPP_HAS_AARCH64
         llvm2uc_register = llvm2ucRegisterAArch64;
-        parseInstAArch64(inst, opc, idecinfs_, iinfo);
+        parseInstAArch64(inst, opc, iinfo);
 #endif
       } else {
 #if ICPP_HAS_X64
         llvm2uc_register = llvm2ucRegisterX64;
-        parseInstX64(inst, opc, idecinfs_, iinfo);
+        parseInstX64(inst, opc, iinfo);
 #endif
       }
-      // check and resolve the relocation symbol
-#if ARCH_ARM64
-      auto found = rsyms.find(iinfo.rva);
-#else
-      auto found = rsyms.end();
-      for (int i = 1; i <= iinfo.len - 4; i++) {
-        found = rsyms.find(iinfo.rva + i);
-        if (found != rsyms.end())
-          break;
-      }
-#endif
-      if (found != rsyms.end()) {
-        const void *rtaddr = nullptr;
-        auto &rsym = found->second;
-        auto symtype = reloc_symtype(iinfo, arch(), type(), rsym);
-        if (rsym.sflags & SymbolRef::SF_Undefined) {
-          // an extern relocation
-          rtaddr =
-              Loader::locateSymbol(rsym.name, symtype == SymbolRef::ST_Data);
-        } else {
-          // a local relocation
-          auto expSect = rsym.sym.getSection();
-          auto expAddr = rsym.sym.getAddress();
-          if (!expSect || !expAddr) {
-            // never be here
-            log_print(
-                Runtime,
-                "Fatal error, the symbol section/address of '{}'.'{:x}' is "
-                "missing for "
-                "relocation.",
-                rsym.name.data(), vm2rva(opc));
-            abort();
-          }
-          bool dyn = false;
-          auto sectname = expSect.get()->getName();
-          if (!sectname) {
-            // never be here
-            log_print(
-                Runtime,
-                "Fatal error, the section name is missing for relocation.");
-            abort();
-          }
-          auto symoff =
-              expAddr.get() - expSect.get()->getAddress() + rsym.addend;
-          for (auto &ds : dynsects_) {
-            if (expSect.get()->getIndex() == ds.index) {
-              // dynamically allocated section
-              dyn = true;
-
-              rtaddr =
-                  reinterpret_cast<const void *>(ds.buffer.data() + symoff);
-              break;
-            }
-          }
-          if (!dyn) {
-            // inner section from file
-            auto expContent = expSect.get()->getContents();
-            if (!expContent) {
-              // never be here
-              log_print(
-                  Runtime,
-                  "Fatal error, the section content of '{}' is missing for "
-                  "relocation.",
-                  sectname->data());
+      relocate(iinfo);
+      // encode none-hardware instruction if there's no one
+      if (iinfo.type != INSN_HARDWARE) {
+        auto opcodes =
+            std::string_view(reinterpret_cast<char *>(opc), iinfo.len);
+        auto found = metas.find(opcodes);
+        if (found == metas.end()) {
+          auto &imetabuf = chunk.imetabuf;
+          // keep each meta data 8 bytes aligned
+          imetabuf.resize((imetabuf.size() + 7) & ~7ULL);
+          auto offset = static_cast<uint32_t>(imetabuf.size());
+          found = metas.insert({opcodes, offset}).first;
+          // we encode the instruction operands as follows:
+          // if it's a register, then encode it to uc register index as
+          // uint16_t if it's an immediate, then encode it as uint64_t
+          for (unsigned i = 0; i < inst.getNumOperands(); i++) {
+            auto opr = inst.getOperand(i);
+            if (opr.isImm()) {
+              auto imm = opr.getImm();
+              imetabuf.append(reinterpret_cast<char *>(&imm), sizeof(imm));
+            } else if (opr.isReg()) {
+              auto reg = llvm2uc_register(opr.getReg());
+              imetabuf.append(reinterpret_cast<char *>(&reg), sizeof(reg));
+            } else {
+              // nerver be here
+              log_print(Runtime,
+                        "Fatal error when decoding instruction at {:x}.",
+                        vm2rva(opc));
               abort();
             }
-            rtaddr =
-                reinterpret_cast<const void *>(expContent->data() + symoff);
-          }
-        }
-        // check the existed relocation
-        auto rit = irelocs_.end();
-        for (auto it = irelocs_.begin(), end = irelocs_.end(); it != end;
-             it++) {
-          if (rtaddr == it->target && symtype == it->type) {
-            rit = it;
-            // fix it as a data relocation for coff object
-            if (arch_ == AArch64 && ofile_->isCOFF() &&
-                (rsym.sflags & SymbolRef::SF_Undefined)) {
-#undef IMAGE_REL_ARM64_PAGEOFFSET_12L
-              if (rsym.rtype ==
-                  COFF::RelocationTypesARM64::IMAGE_REL_ARM64_PAGEOFFSET_12L) {
-                symtype = SymbolRef::ST_Data;
-                it->target = Loader::locateSymbol(rsym.name, true);
-                it->type = symtype;
-              }
-            }
-            break;
-          }
-        }
-        if (rit == irelocs_.end()) {
-          // insert a new relocation record
-          rit = irelocs_.insert(irelocs_.end(),
-                                RelocInfo{rsym.name.data(), rtaddr,
-                                          static_cast<uint32_t>(symtype)});
-        }
-        if (0) {
-          log_print(Develop, "Relocated {:06x}.{} symbol {} at {}.",
-                    (int)iinfo.rva,
-                    symtype == SymbolRef::ST_Data ? "data" : "func", rit->name,
-                    rit->target);
-        }
-        // record its relocation index
-        iinfo.rflag = 1;
-        iinfo.reloc = rit - irelocs_.begin();
-      }
-      // encode none-hardware instruction if there's no one
-      if (iinfo.type != INSN_HARDWARE &&
-          idecinfs_.find(std::string(reinterpret_cast<char *>(opc),
-                                     iinfo.len)) == idecinfs_.end()) {
-        auto newi =
-            idecinfs_
-                .insert({std::string(reinterpret_cast<char *>(opc), iinfo.len),
-                         std::string()})
-                .first;
-        auto optr = const_cast<std::string *>(&newi->second);
-        // we encode the instruction operands as follows:
-        // if it's a register, then encode it to uc register index as uint16_t
-        // if it's an immediate, then encode it as uint64_t
-        for (unsigned i = 0; i < inst.getNumOperands(); i++) {
-          auto opr = inst.getOperand(i);
-          if (opr.isImm()) {
-            auto imm = opr.getImm();
-            optr->append(
-                std::string(reinterpret_cast<char *>(&imm), sizeof(imm)));
-          } else if (opr.isReg()) {
-            auto reg = llvm2uc_register(opr.getReg());
-            optr->append(
-                std::string(reinterpret_cast<char *>(&reg), sizeof(reg)));
-          } else {
-            // nerver be here
-            log_print(Runtime, "Fatal error when decoding instruction at {:x}.",
-                      vm2rva(opc));
-            abort();
           }
+          chunk.metasizes[offset] =
+              static_cast<uint32_t>(imetabuf.size()) - offset;
         }
+        imeta = found->second;
       }
       break;
     }
     } // end of switch
-    text.iinfs.push_back(iinfo);
+    chunk.iinfs.push_back(iinfo);
+    chunk.imetas.push_back(imeta);
     opc += iinfo.len;
+    if (fend && opc >= fend) {
+      if (opc == fend) {
+        func.icount = static_cast<uint32_t>(chunk.iinfs.size()) - func.ibegin;
+        chunk.ifuncs.push_back(func);
+      }
+      fend = 0;
+    }
+  }
+  chunk.stop = opc;
+}
+
+bool Object::initLazily(std::span<const IObjText> texts,
+                        std::span<const uint32_t> islots) {
+  if (!rva_encodable(textsects_)) {
+    log_print(Runtime, "The text sections of {} are too large to decode.",
+              path_);
+    return false;
+  }
+  auto ld = odiser_.LD = new LazyDecoder;
+  ld->disasm = odiser_.DT->createDisassembler(ld->context);
+  for (auto &f : funcs_)
+    ld->entries.push_back(reinterpret_cast<uint64_t>(f.second));
+  std::sort(ld->entries.begin(), ld->entries.end());
+
+  // each text section occupies its slot count of instructions
+  uint32_t count = 0;
+  size_t nrelocs = 0;
+  ld->rsyms.resize(textsects_.size());
+  for (size_t i = 0; i < textsects_.size(); i++) {
+    auto &text = textsects_[i];
+    reloc_symbols(ofile_.get(), arch(), text, ld->rsyms[i]);
+    nrelocs += ld->rsyms[i].size();
+    text.ibegin = count;
+    text.icount = (text.size >> islotShift()) + 1;
+    text.islots = {};
+    text.islotbuf.clear();
+    count += text.icount;
+  }
+  // one slot per possible instruction start, the tables are reserved in the
+  // zero filled pages so that only the slots of the decoded functions cost
+  // memory, the unpublished flags read as false, std::atomic<bool> has the
+  // same layout as bool
+  ld->insts = pages_table<InsnInfo>(count);
+  ld->metas = pages_table<uint32_t>(count);
+  lazyflags_ = pages_table<std::atomic<bool>>(count);
+  lazyblocks_ = pages_table<const char *>(1ULL << (32 - lazy_block_shift));
+  if (widerelocs_.size())
+    ld->wides = pages_table<uint32_t>(count);
+  if (!ld->insts || !ld->metas || !lazyflags_ || !lazyblocks_ ||
+      (widerelocs_.size() && !ld->wides)) {
+    log_print(Runtime, "Failed to allocate the lazy decoding tables of {}.",
+              path_);
+    return false;
+  }
+  // each relocation symbol adds one relocation at most, reserve them so that
+  // the published ones are never moved
+  irelocs_.reserve(irelocs_.size() + nrelocs);
+
+  // import the decoded instructions of the .io cache
+  if (texts.size()) {
+    if (texts.size() != textsects_.size())
+      return false;
+    // <cached meta offset, lazy meta offset>, the cached meta size is the
+    // distance to the next one
+    std::map<uint32_t, uint32_t> offsets;
+    for (auto m : metas_) {
+      if (m == imeta_none)
+        continue;
+      if (m >= metabuf_.size())
+        return false;
+      offsets[m] = imeta_none;
+    }
+    for (auto it = offsets.begin(); it != offsets.end(); it++) {
+      auto next = std::next(it);
+      auto size = (next == offsets.end() ? metabuf_.size() : next->first) -
+                  it->first;
+      if (size > lazy_block_size)
+        return false;
+      it->second = ld->append(lazyblocks_.get(), &metabuf_[it->first],
+                              static_cast<uint32_t>(size));
+    }
+    for (size_t i = 0; i < texts.size(); i++) {
+      auto &ts = textsects_[i];
+      auto &it = texts[i];
+      if (it.scount != ts.icount)
+        return false;
+      for (uint32_t j = 0; j < it.scount; j++) {
+        auto index = islots[it.sbegin + j];
+        if (index == islot_none)
+          continue;
+        if (index >= insts_.size())
+          return false;
+        auto slot = ts.ibegin + j;
+        ld->insts[slot] = insts_[index];
+        if (ld->wides)
+          ld->wides[slot] = widerelocs_[index];
+        ld->metas[slot] =
+            metas_[index] == imeta_none ? imeta_none : offsets[metas_[index]];
+        lazyflags_[slot] = true;
+      }
+    }
+  }
+  insts_ = {ld->insts.get(), count};
+  metas_ = {ld->metas.get(), count};
+  metabuf_ = {};
+  widerelocs_ = {ld->wides.get(), ld->wides ? count : 0};
+  lazy_ = true;
+  return true;
+}
+
+void Object::decodeLazily(size_t ti, uint64_t vm) {
+  auto ld = odiser_.LD;
+  std::lock_guard lock(ld->mutex);
+  auto &text = textsects_[ti];
+  auto index = text.ibegin + ((vm - text.vm) >> islotShift());
+  if (lazyflags_[index].load(std::memory_order_relaxed))
+    return; // decoded by the other thread
+
+  // the function range which vm belongs to
+  auto start = text.vm, end = text.vm + text.size;
+  auto it = std::upper_bound(ld->entries.begin(), ld->entries.end(), vm);
+  if (it != ld->entries.end() && *it < end)
+    end = *it;
+  if (it != ld->entries.begin())
+    start = std::max(start, *(it - 1));
+  // decode from vm itself if it isn't at the instruction boundary of this
+  // function, e.g.: there's data in code
+  for (auto from : {start, vm}) {
+    DecodeChunk chunk{&text, &ld->rsyms[ti], from, end};
+    decodeChunk(chunk, *ld->disasm);
+    publishChunk(chunk);
+    if (lazyflags_[index].load(std::memory_order_relaxed))
+      break;
+  }
+  lazydirty_ = true;
+  log_print(Develop, "Decoded {:x}-{:x} lazily.", vm2vrva(start),
+            vm2vrva(end));
+}
+
+void Object::publishChunk(DecodeChunk &chunk) {
+  auto ld = odiser_.LD;
+  auto &text = *chunk.text;
+  auto rbegin = irelocs_.size();
+  auto rit = chunk.relocs.begin();
+  std::vector<uint32_t> published;
+  for (uint32_t i = 0; i < chunk.iinfs.size(); i++) {
+    auto iinfo = chunk.iinfs[i];
+    auto index = text.ibegin + ((iinfo.rva - text.frva) >> islotShift());
+    auto reloc = rit != chunk.relocs.end() && std::get<0>(*rit) == i
+                     ? &*rit++
+                     : nullptr;
+    if (lazyflags_[index].load(std::memory_order_relaxed))
+      continue; // keep the published one untouched
+    auto opc = text.vm + iinfo.rva - text.frva;
+    if (reloc)
+      setReloc(iinfo, index,
+               relocateInsn(opc, std::get<1>(*reloc), std::get<2>(*reloc)));
+    auto imeta = chunk.imetas[i];
+    if (imeta != imeta_none) {
+      auto opcodes = std::string_view(reinterpret_cast<char *>(opc), iinfo.len);
+      auto found = ld->metacache.find(opcodes);
+      if (found == ld->metacache.end()) {
+        auto offset = ld->append(lazyblocks_.get(), &chunk.imetabuf[imeta],
+                                 chunk.metasizes[imeta]);
+        found = ld->metacache.insert({opcodes, offset}).first;
+      }
+      imeta = found->second;
+    }
+    ld->insts[index] = iinfo;
+    ld->metas[index] = imeta;
+    published.push_back(index);
+  }
+  classifyRelocs(rbegin);
+  // make them visible to the readers after all the writes above
+  for (auto index : published)
+    lazyflags_[index].store(true, std::memory_order_release);
+}
+
+void Object::compactInsns(std::vector<IObjText> &texts,
+                          std::vector<uint32_t> &islots,
+                          std::vector<InsnInfo> &insts,
+                          std::vector<uint32_t> &metas, std::string &metabuf,
+                          std::vector<uint32_t> &wides) {
+  auto ld = odiser_.LD;
+  std::lock_guard lock(ld->mutex);
+  // <lazy meta offset, compact meta offset>
+  std::unordered_map<uint32_t, uint32_t> offsets;
+  for (auto &ts : textsects_) {
+    auto ibegin = static_cast<uint32_t>(insts.size());
+    auto sbegin = static_cast<uint32_t>(islots.size());
+    for (uint32_t i = ts.ibegin, end = ts.ibegin + ts.icount; i < end; i++) {
+      if (!lazyflags_[i].load(std::memory_order_relaxed)) {
+        islots.push_back(islot_none);
+        continue;
+      }
+      auto imeta = ld->metas[i];
+      if (imeta != imeta_none) {
+        auto found = offsets.find(imeta);
+        if (found == offsets.end()) {
+          // keep each meta data 8 bytes aligned
+          metabuf.resize((metabuf.size() + 7) & ~7ULL);
+          found =
+              offsets.insert({imeta, static_cast<uint32_t>(metabuf.size())})
+                  .first;
+          metabuf.append(lazyblocks_[imeta >> lazy_block_shift] +
+                             (imeta & (lazy_block_size - 1)),
+                         ld->metasizes[imeta]);
+        }
+        imeta = found->second;
+      }
+      islots.push_back(static_cast<uint32_t>(insts.size()));
+      insts.push_back(ld->insts[i]);
+      metas.push_back(imeta);
+      if (ld->wides)
+        wides.push_back(ld->wides[i]);
+    }
+    texts.push_back(IObjText{ibegin,
+                             static_cast<uint32_t>(insts.size()) - ibegin,
+                             sbegin, ts.icount});
+  }
+}
+
+// patch the relocated branch instruction to jump to target directly
+static bool patch_branch(ArchType arch, const InsnInfo &inst, uint64_t vm,
+                         uint64_t target) {
+  auto opc = reinterpret_cast<uint8_t *>(vm);
+  if (arch == AArch64) {
+    // b/bl imm26
+    uint32_t code;
+    std::memcpy(&code, opc, sizeof(code));
+    if ((code & 0x7C000000) != 0x14000000)
+      return false;
+    auto delta = static_cast<int64_t>(target - vm);
+    if ((delta & 3) || delta < -(1LL << 27) || delta >= (1LL << 27))
+      return false;
+    code = (code & 0xFC000000) | ((delta >> 2) & 0x03FFFFFF);
+    std::memcpy(opc, &code, sizeof(code));
+    return true;
+  }
+  // call/jmp rel32 or jcc rel32
+  int dispoff = 0;
+  if (inst.len == 5 && (opc[0] == 0xE8 || opc[0] == 0xE9))
+    dispoff = 1;
+  else if (inst.len == 6 && opc[0] == 0x0F && (opc[1] & 0xF0) == 0x80)
+    dispoff = 2;
+  if (!dispoff)
+    return false;
+  auto delta = static_cast<int64_t>(target - (vm + inst.len));
+  if (delta != static_cast<int32_t>(delta))
+    return false;
+  auto disp = static_cast<int32_t>(delta);
+  std::memcpy(opc + dispoff, &disp, sizeof(disp));
+  return true;
+}
+
+void Object::buildSuperblocks() {
+  if (!RunConfig::inst()->superblock() || lazy_)
+    return;
+
+  sbexits_.assign(insts_.size(), false);
+  for (auto &ts : textsects_) {
+    for (uint32_t i = ts.ibegin, end = ts.ibegin + ts.icount; i < end; i++) {
+      auto &inst = insts_[i];
+      auto vm = ts.vm + inst.rva - ts.frva;
+      bool native = can_emulate(&inst);
+      switch (inst.type) {
+      case INSN_CONDJUMP:
+      case INSN_ARM64_CALL:
+      case INSN_ARM64_JUMP:
+      case INSN_X64_CALL:
+      case INSN_X64_JUMP:
+      case INSN_X64_JUMPCOND: {
+        if (!inst.rflag) {
+          // branch inside this text section
+          native = true;
+          break;
+        }
+        // branch to another function of this object
+        auto target = reinterpret_cast<uint64_t>(relocTarget(&inst));
+        if (executable(target, nullptr))
+          native = patch_branch(arch(), inst, vm, target);
+        break;
+      }
+      default:
+        break;
+      }
+      if (!native) {
+        sbexits_[i] = true;
+        sbexitvms_.push_back(vm);
+      }
+    }
   }
 }
 
@@ -5,17 +5,20 @@
 */
 
 #include "object.h"
+#include "exec.h"
 #include "icpp.h"
 #include "loader.h"
 #include "platform.h"
 #include "runcfg.h"
 #include "utils.h"
-#include <boost/beast.hpp>
+#include <cstring>
 #include <fstream>
-#include <icppiobj.pb.h>
 #include <iostream>
 #include <llvm/Object/ObjectFile.h>
+#include <llvm/Support/FileSystem.h>
 #include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Process.h>
+#include <set>
 #include <span>
 
 using CSymbolRef = llvm::object::SymbolRef;
@@ -92,7 +95,12 @@ void Object::createFromMemory(ObjectType type) {
     odiser_.init(ofile_.get(), triple());
     parseSections();
     parseSymbols();
-    decodeInsns();
+    if (RunConfig::inst()->lazyDecode() && ofile_->isRelocatableObject()) {
+      if (!initLazily())
+        arch_ = Unsupported;
+    } else {
+      decodeInsns();
+    }
   } else {
     std::cout << "Failed to create llvm object: "
               << llvm::toString(std::move(expObj.takeError())) << std::endl;
@@ -184,6 +192,19 @@ void Object::parseSymbols() {
   }
 }
 
+std::string_view Object::functionName(uint64_t vm) {
+  std::string_view name;
+  uint64_t start = 0;
+  for (auto &f : funcs_) {
+    auto addr = reinterpret_cast<uint64_t>(f.second);
+    if (start < addr && addr <= vm) {
+      start = addr;
+      name = f.first;
+    }
+  }
+  return name;
+}
+
 const void *Object::mainEntry() {
   auto found = funcs_.find("_main");
   if (found == funcs_.end()) {
@@ -240,7 +261,7 @@ std::vector<const void *> Object::ctorEntries() {
   for (auto it = ctors.begin(); it != ctors.end();) {
     auto inst = insnInfo(reinterpret_cast<uint64_t>(*it));
     if (inst->rflag) {
-      auto &reloc = irelocs_[inst->reloc];
+      auto &reloc = irelocs_[relocIndex(inst)];
       if (reloc.name.find(cppm_init_func) != std::string::npos) {
         // remove the cpp module initializer nop function
         it = ctors.erase(it);
@@ -263,14 +284,44 @@ const InsnInfo *Object::insnInfo(uint64_t vm) {
   auto rva = static_cast<uint32_t>(vm2rva(vm, &ti));
   // find insninfo related to this vm address
   auto &ts = textsects_[ti];
-  auto found =
-      std::lower_bound(ts.iinfs.begin(), ts.iinfs.end(), InsnInfo{.rva = rva});
-  if (found == ts.iinfs.end()) {
-    log_print(Runtime, "Failed to find instruction information of rva {:x}.",
-              rva);
-    abort();
+  auto slot = (rva - ts.frva) >> islotShift();
+  if (lazy_) {
+    // the instruction index is the slot index, decode it at the first time
+    auto index = ts.ibegin + slot;
+    if (slot < ts.icount) {
+      if (!lazyflags_[index].load(std::memory_order_acquire))
+        decodeLazily(ti, vm);
+      if (lazyflags_[index].load(std::memory_order_acquire))
+        return &insts_[index];
+    }
+  } else if (slot < ts.islots.size() && ts.islots[slot] != islot_none) {
+    return &insts_[ts.islots[slot]];
+  }
+  log_print(Runtime, "Failed to find instruction information of rva {:x}.",
+            rva);
+  abort();
+}
+
+const InsnInfo *Object::decodedInsn(uint64_t vm) {
+  for (auto &ts : textsects_) {
+    if (ts.vm <= vm && vm < ts.vm + ts.size) {
+      auto index = ts.ibegin + ((vm - ts.vm) >> islotShift());
+      if (lazyflags_[index].load(std::memory_order_acquire))
+        return &insts_[index];
+      break;
+    }
   }
-  return &*found;
+  return nullptr;
+}
+
+void Object::indexInsns(TextSection &text) {
+  auto shift = islotShift();
+  text.islotbuf.assign((text.size >> shift) + 1, islot_none);
+  for (uint32_t i = text.ibegin, end = text.ibegin + text.icount; i < end;
+       i++) {
+    text.islotbuf[(insts_[i].rva - text.frva) >> shift] = i;
+  }
+  text.islots = text.islotbuf;
 }
 
 uint64_t Object::vm2rva(uint64_t vm, size_t *ti) {
@@ -314,6 +365,15 @@ uint64_t Object::vm2vrva(uint64_t vm) {
   return -1;
 }
 
+uint64_t Object::vrva2vm(uint64_t vrva) {
+  for (size_t i = 0; i < textsects_.size(); i++) {
+    auto &s = textsects_[i];
+    if (s.vrva <= vrva && vrva < s.vrva + s.size)
+      return s.vm + vrva - s.vrva;
+  }
+  return -1;
+}
+
 bool Object::executable(uint64_t vm, Object **iobject) {
   for (size_t i = 0; i < textsects_.size(); i++) {
     auto &s = textsects_[i];
@@ -326,6 +386,36 @@ bool Object::executable(uint64_t vm, Object **iobject) {
   return iobject ? Loader::executable(vm, iobject) : false;
 }
 
+void Object::snapshot() {
+  auto image = ofile_->getData();
+  snapimage_.assign(image.data(), image.size());
+  snapdyns_.clear();
+  for (auto &ds : dynsects_)
+    snapdyns_.push_back(ds.buffer);
+}
+
+void Object::restore() {
+  if (!snapimage_.size())
+    return;
+  auto image = ofile_->getData();
+  std::memcpy(const_cast<char *>(image.data()), snapimage_.data(),
+              snapimage_.size());
+  for (size_t i = 0; i < snapdyns_.size(); i++)
+    std::memcpy(dynsects_[i].buffer.data(), snapdyns_[i].data(),
+                snapdyns_[i].size());
+}
+
+uint64_t Object::memoryUsage() {
+  uint64_t usage = insts_.size_bytes() + metas_.size_bytes() +
+                   metabuf_.size() + widerelocs_.size_bytes() +
+                   irelocs_.size() * sizeof(RelocInfo) + snapimage_.size();
+  for (auto &r : memoryRanges())
+    usage += r.end - r.start;
+  for (auto &s : snapdyns_)
+    usage += s.size();
+  return usage;
+}
+
 std::string Object::cachePath() {
   auto srcpath = fs::path(srcpath_);
   return (srcpath.parent_path() / (srcpath.stem().string() + iobj_ext.data()))
@@ -349,6 +439,34 @@ bool Object::belong(uint64_t vm, size_t *di) {
   return false;
 }
 
+std::vector<AddressRange> Object::textRanges() {
+  std::vector<AddressRange> ranges;
+  for (auto &s : textsects_)
+    ranges.push_back({s.vm, s.vm + s.size});
+  return ranges;
+}
+
+std::vector<AddressRange> Object::memoryRanges() {
+  std::vector<AddressRange> ranges;
+  ranges.push_back({reinterpret_cast<uint64_t>(fbuf_->getBufferStart()),
+                    reinterpret_cast<uint64_t>(fbuf_->getBufferEnd())});
+  for (auto &s : dynsects_) {
+    auto start = reinterpret_cast<uint64_t>(s.buffer.data());
+    ranges.push_back({start, start + s.buffer.size()});
+  }
+  return ranges;
+}
+
+void Object::classifyRelocs(size_t begin) {
+  for (size_t i = begin; i < irelocs_.size(); i++) {
+    auto &r = irelocs_[i];
+    // only the direct function call target can be classified statically
+    if (r.type != CSymbolRef::ST_Data &&
+        !belong(reinterpret_cast<uint64_t>(r.target)))
+      r.ctype = exec_call_type(r.target);
+  }
+}
+
 const void *RelocInfo::realTarget() {
   if (Loader::globalLocal(reinterpret_cast<uint64_t>(target)))
     return target;
@@ -357,42 +475,93 @@ const void *RelocInfo::realTarget() {
              : target;
 }
 
-std::string Object::generateCache() {
-  namespace iobj = com::vpand::icppiobj;
-  namespace base64 = boost::beast::detail::base64;
+// append a section to the flat .io file buffer, the section directory
+// has been reserved right after the header
+static void iobj_append(std::string &buffer, IObjSectionType type,
+                        const void *data, size_t size, size_t align = 8) {
+  buffer.resize((buffer.size() + align - 1) & ~(align - 1));
+  auto sects = reinterpret_cast<IObjSection *>(&buffer[sizeof(IObjHeader)]);
+  sects[type] = IObjSection{type, 0, buffer.size(), size};
+  buffer.append(reinterpret_cast<const char *>(data), size);
+}
+
+std::string iobj_section(std::string_view path, IObjSectionType type) {
+  std::ifstream inf(path.data(), std::ios::binary);
+  IObjHeader header;
+  if (!inf.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+      header.magic != iobj_magic ||
+      (header.format != iobj_format && header.format != iobj_format_wide) ||
+      header.version != version_value().value || header.count > 256)
+    return "";
+  std::vector<IObjSection> dir(header.count);
+  if (!inf.read(reinterpret_cast<char *>(dir.data()),
+                dir.size() * sizeof(IObjSection)))
+    return "";
+  for (auto &sect : dir) {
+    if (sect.type != type)
+      continue;
+    std::string content(sect.size, 0);
+    if (!inf.seekg(sect.offset) || !inf.read(content.data(), sect.size))
+      return "";
+    return content;
+  }
+  return "";
+}
+
+// read the size and modification time of a prelinked module file
+static bool prelink_stat(std::string_view path, IObjPrelinkModule &pm) {
+  std::error_code err;
+  pm.size = fs::file_size(path, err);
+  if (err)
+    return false;
+  auto mtime = fs::last_write_time(path, err);
+  pm.mtime = static_cast<int64_t>(mtime.time_since_epoch().count());
+  return !err;
+}
 
+std::string Object::generateCache() {
   // construct the iobj file
-  iobj::InterpObject iobject;
-  iobject.set_magic(iobj_magic);
-  iobject.set_version(version_value().value);
-  iobject.set_arch(static_cast<iobj::ArchType>(arch_));
-  iobject.set_otype(static_cast<iobj::ObjectType>(type_));
-  iobject.set_icpp(main_program());
-
-  auto iins = iobject.mutable_instinfos();
-  for (auto &ts : textsects_) {
-    iobj::InsnInfos iinfos;
-    auto infos = iinfos.mutable_infos();
-    infos->Resize(ts.iinfs.size(), 0);
-    std::memcpy(infos->mutable_data(), &ts.iinfs[0],
-                ts.iinfs.size() * sizeof(uint64_t));
-    iins->Add(std::move(iinfos));
-  }
-
-  auto imetas = iobject.mutable_instmetas();
-  for (auto &m : idecinfs_) {
-    // as we use string as protobuf's map key, so we have to encode it as a real
-    // string, otherwise its serialization will warn
-    auto keysz = base64::encoded_size(m.first.length());
-    std::string tmpkey(keysz, '\0');
-    keysz = base64::encode(
-        reinterpret_cast<void *>(const_cast<char *>(tmpkey.data())),
-        m.first.data(), m.first.length());
-    imetas->insert({std::string(tmpkey.data(), keysz), m.second});
-  }
-
-  auto imods = iobject.mutable_modules();
-  auto irefs = iobject.mutable_irefsyms();
+  std::string iobject(sizeof(IObjHeader) +
+                          sizeof(IObjSection) * IOBJ_SECTION_COUNT,
+                      0);
+  auto header = reinterpret_cast<IObjHeader *>(&iobject[0]);
+  header->magic = iobj_magic;
+  header->format = iobj_format;
+  header->version = version_value().value;
+  header->arch = static_cast<uint16_t>(arch_);
+  header->otype = static_cast<uint16_t>(type_);
+  header->count = IOBJ_SECTION_COUNT;
+  header->flags = lazy_ ? IOBJ_FLAG_LAZY : 0;
+
+  std::vector<IObjText> texts;
+  std::vector<uint32_t> islots;
+  auto insts = insts_;
+  auto metas = metas_;
+  auto metabuf = metabuf_;
+  // the lazily decoded instructions are compacted like the eager ones
+  std::vector<InsnInfo> linsts;
+  std::vector<uint32_t> lmetas;
+  std::string lmetabuf;
+  auto wides = widerelocs_;
+  std::vector<uint32_t> lwides;
+  if (lazy_) {
+    compactInsns(texts, islots, linsts, lmetas, lmetabuf, lwides);
+    insts = linsts;
+    metas = lmetas;
+    metabuf = lmetabuf;
+    wides = lwides;
+  } else {
+    for (auto &ts : textsects_) {
+      texts.push_back(IObjText{ts.ibegin, ts.icount,
+                               static_cast<uint32_t>(islots.size()),
+                               static_cast<uint32_t>(ts.islots.size())});
+      islots.insert(islots.end(), ts.islots.begin(), ts.islots.end());
+    }
+  }
+
+  std::vector<std::string> imods;
+  std::vector<IObjReloc> irefs;
+  std::string symbols;
   std::set<std::string> refmods;
   std::vector<RelocInfo *> misbelong;
   Loader::locateModule("", true); // update loader's module list
@@ -426,12 +595,15 @@ std::string Object::generateCache() {
     }
     return "";
   }
-  imods->Add("self");
+  imods.push_back("self");
   for (auto &m : refmods) {
-    imods->Add(m.data());
+    imods.push_back(m.data());
   }
+  // the external relocation targets to prelink
+  std::vector<uint64_t> externs;
   for (auto &r : irelocs_) {
     auto target = reinterpret_cast<uint64_t>(r.realTarget());
+    externs.push_back(prelink_none);
     size_t di = -1;
     bool self = belong(target, &di);
     if (!self) {
@@ -440,59 +612,145 @@ std::string Object::generateCache() {
         target = reinterpret_cast<uint64_t>(r.target);
     }
 
-    iobj::RelocInfo ri;
-    ri.set_symbol(r.name);
-    ri.set_type(r.type);
+    IObjReloc ri{};
+    ri.symbol = static_cast<uint32_t>(symbols.size());
+    symbols.append(r.name.data(), r.name.size() + 1);
+    ri.type = r.type;
 
     if (self) {
       if (di != -1) {
         // it's in dynamical section
-        ri.set_dindex(static_cast<uint32_t>(di));
-        ri.set_rva(reinterpret_cast<const char *>(target) -
-                   dynsects_[di].buffer.data());
+        ri.dindex = static_cast<uint32_t>(di);
+        ri.rva = reinterpret_cast<const char *>(target) -
+                 dynsects_[di].buffer.data();
       } else {
-        ri.set_dindex(-1);
-        ri.set_rva(target - textsects_[0].vm);
+        ri.dindex = -1;
+        ri.rva = target - textsects_[0].vm;
       }
-      ri.set_module(0); // set self module index
+      ri.module = 0; // set self module index
     } else {
-      ri.set_dindex(-1);
-      ri.set_rva(-1);
+      ri.dindex = -1;
+      ri.rva = -1;
+      if (!Loader::globalLocal(target))
+        externs.back() = target;
       auto tarmod =
           Loader::locateModule(reinterpret_cast<const void *>(target));
-      for (size_t i = 1; i < imods->size(); i++) {
-        if (imods->at(i) == tarmod) {
+      for (size_t i = 1; i < imods.size(); i++) {
+        if (imods[i] == tarmod) {
           // set external module index
-          ri.set_module(i);
+          ri.module = i;
           break;
         }
       }
     }
-    irefs->Add(std::move(ri));
+    irefs.push_back(ri);
   }
-
-  // set the original object buffer
-  auto errBuff = llvm::MemoryBuffer::getFile(path_);
-  if (!errBuff) {
-    log_print(Develop, "Failed to read when caching '{}' : {}.", path_,
-              errBuff.getError().message());
-    return "";
+  std::string modules;
+  for (auto &m : imods)
+    modules.append(m.data(), m.size() + 1);
+
+  // prelink the external relocations to their module relative offsets, so
+  // that the next loading rebases them rather than looking up the symbols
+  std::string prelink(sizeof(IObjPrelink), 0);
+  std::vector<uint64_t> bases(imods.size(), prelink_none);
+  uint32_t prelinked = 0;
+  for (size_t i = 1; i < imods.size(); i++) {
+    auto &m = imods[i];
+    IObjPrelinkModule pm{static_cast<uint32_t>(i)};
+    if (m.ends_with(iobj_ext) || m.ends_with(obj_ext) ||
+        !prelink_stat(m, pm))
+      continue;
+    bases[i] = Loader::moduleBase(m);
+    if (bases[i] == prelink_none)
+      continue;
+    prelink.append(reinterpret_cast<const char *>(&pm), sizeof(pm));
+    prelinked++;
   }
-  iobject.set_objbuf(std::string(errBuff.get()->getBufferStart(),
-                                 errBuff.get()->getBufferSize()));
+  reinterpret_cast<IObjPrelink *>(prelink.data())->count = prelinked;
+  std::vector<uint64_t> offsets(irefs.size(), prelink_none);
+  for (size_t i = 0; i < irefs.size(); i++) {
+    auto module = irefs[i].module;
+    if (module && bases[module] != prelink_none &&
+        externs[i] != prelink_none && externs[i] >= bases[module])
+      offsets[i] = externs[i] - bases[module];
+  }
+  prelink.append(reinterpret_cast<const char *>(offsets.data()),
+                 offsets.size() * sizeof(uint64_t));
+
+  // the original object buffer and the dependency manifest generated while
+  // compiling the source, a .io cache regenerated with the lazily decoded
+  // instructions takes them from itself as its mapped image may have been
+  // modified at runtime
+  std::string image;
+  std::string manifest;
+  if (isCache()) {
+    image = iobj_section(path_, IOBJ_IMAGE);
+    manifest = iobj_section(path_, IOBJ_MANIFEST);
+  } else {
+    auto errBuff = llvm::MemoryBuffer::getFile(path_);
+    if (errBuff) {
+      image = errBuff.get()->getBuffer().str();
+    } else {
+      log_print(Develop, "Failed to read when caching '{}' : {}.", path_,
+                errBuff.getError().message());
+    }
+    auto mfpath = fs::path(path_).replace_extension(imf_ext);
+    if (fs::exists(mfpath)) {
+      auto expMf = llvm::MemoryBuffer::getFile(mfpath.string());
+      if (expMf)
+        manifest = expMf.get()->getBuffer().str();
+    }
+  }
+  if (image.empty())
+    return "";
 
-  // save to io file
+  auto icpp = main_program();
+  iobj_append(iobject, IOBJ_ICPP, icpp.data(), icpp.size() + 1);
+  iobj_append(iobject, IOBJ_TEXTS, texts.data(),
+              texts.size() * sizeof(IObjText));
+  iobj_append(iobject, IOBJ_INSTINFOS, insts.data(), insts.size_bytes());
+  iobj_append(iobject, IOBJ_INSTMETAS, metas.data(), metas.size_bytes());
+  iobj_append(iobject, IOBJ_ISLOTS, islots.data(),
+              islots.size() * sizeof(uint32_t));
+  iobj_append(iobject, IOBJ_METABUF, metabuf.data(), metabuf.size());
+  iobj_append(iobject, IOBJ_MODULES, modules.data(), modules.size());
+  iobj_append(iobject, IOBJ_RELOCS, irefs.data(),
+              irefs.size() * sizeof(IObjReloc));
+  iobj_append(iobject, IOBJ_SYMBOLS, symbols.data(), symbols.size());
+  // page aligned to share the untouched pages after being mapped
+  iobj_append(iobject, IOBJ_IMAGE, image.data(), image.size(), 4096);
+  iobj_append(iobject, IOBJ_MANIFEST, manifest.data(), manifest.size());
+  iobj_append(iobject, IOBJ_PRELINK, prelink.data(), prelink.size());
+  iobj_append(iobject, IOBJ_FUNCTIONS, ifuncs_.data(),
+              ifuncs_.size() * sizeof(IObjFunction));
+  // only the objects with too many relocations use the extended format, so
+  // that the compact ones are still loadable by the older icpp
+  iobj_append(iobject, IOBJ_RELOCIDX, wides.data(), wides.size_bytes());
+  header = reinterpret_cast<IObjHeader *>(&iobject[0]);
+  header->format = wides.size() ? iobj_format_wide : iobj_format;
+
+  // save to io file, as the old one may be mapped by some running icpp
+  // instance, write it to a temporary file and then replace it
   auto cachepath = cachePath();
-  std::ofstream fout(cachepath, std::ios::binary);
-  if (fout.is_open()) {
-    iobject.SerializeToOstream(&fout);
-    log_print(Develop, "Cached the interpretable object {}.", cachepath);
-    return path_;
-  } else {
+  auto tmppath = cachepath + rand_filename(8, ".tmp");
+  std::ofstream fout(tmppath, std::ios::binary);
+  if (!fout.is_open()) {
     log_print(Runtime, "Failed to create interpretable object {}: {}.",
               cachepath, std::strerror(errno));
     return "";
   }
+  fout.write(iobject.data(), iobject.size());
+  fout.close();
+  std::error_code err;
+  fs::rename(tmppath, cachepath, err);
+  if (err) {
+    log_print(Runtime, "Failed to create interpretable object {}: {}.",
+              cachepath, err.message());
+    fs::remove(tmppath, err);
+    return "";
+  }
+  log_print(Develop, "Cached the interpretable object {}.", cachepath);
+  return path_;
 }
 
 const void *Object::locateSymbol(std::string_view name) {
@@ -547,6 +805,10 @@ const void *Object::relocTarget(size_t i) {
 
 Object::~Object() {}
 
+void *PagesDeleter::alloc(size_t size) { return pages_alloc(size); }
+
+void PagesDeleter::operator()(const void *pages) { pages_free(pages, size); }
+
 MachOObject::MachOObject(std::string_view srcpath, std::string_view path)
     : Object(srcpath, path) {}
 
@@ -633,50 +895,101 @@ COFFExeObject::COFFExeObject(std::string_view srcpath, std::string_view path)
 
 COFFExeObject::~COFFExeObject() {}
 
+std::string iobj_manifest(std::string_view path) {
+  return iobj_section(path, IOBJ_MANIFEST);
+}
+
+// view a section of the mapped .io file as an array
+template <typename T>
+static std::span<const T> iobj_array(std::string_view sect) {
+  return {reinterpret_cast<const T *>(sect.data()), sect.size() / sizeof(T)};
+}
+
 InterpObject::InterpObject(std::string_view srcpath, std::string_view path)
     : Object(srcpath, path) {
-  namespace iobj = com::vpand::icppiobj;
-  namespace base64 = boost::beast::detail::base64;
-
-  // herein we pass IsVolatile as true to disable llvm to mmap this file
-  // because some data sections may be modified at runtime
-  auto errBuff = llvm::MemoryBuffer::getFile(path_, false, true, true);
-  if (!errBuff) {
-    std::cout << "Failed to read '" << path_
-              << "': " << errBuff.getError().message() << std::endl;
-    return;
+  namespace sfs = llvm::sys::fs;
+
+  // map the whole file in private mode, the pages of the data sections
+  // modified at runtime are copied on write, the others are used in place
+  int fd = -1;
+  uint64_t fsize = 0;
+  auto err = sfs::openFileForRead(path_, fd);
+  if (!err)
+    err = sfs::file_size(path_, fsize);
+  if (!err && fsize < sizeof(IObjHeader))
+    err = std::make_error_code(std::errc::invalid_argument);
+  if (!err) {
+    region_ = std::make_unique<sfs::mapped_file_region>(
+        sfs::convertFDToNativeFile(fd), sfs::mapped_file_region::priv, fsize,
+        0, err);
   }
-  // construct the iobject instance
-  iobj::InterpObject iobject;
-  if (!iobject.ParseFromArray(errBuff.get()->getBufferStart(),
-                              errBuff.get()->getBufferSize())) {
-    log_print(Runtime, "Can't load the file {}, it's corrupted.", path_);
+  if (fd >= 0)
+    llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+  if (err) {
+    std::cout << "Failed to read '" << path_ << "': " << err.message()
+              << std::endl;
+    region_.reset();
     return;
   }
-  if (iobject.magic() != iobj_magic) {
+
+  auto base = region_->const_data();
+  auto header = reinterpret_cast<const IObjHeader *>(base);
+  if (header->magic != iobj_magic) {
     log_print(
         Runtime,
         "Can't load the file {}, it isn't an icpp interpretable object file.",
         path_);
     return;
   }
-  if (iobject.version() != version_value().value) {
+  if ((header->format != iobj_format && header->format != iobj_format_wide) ||
+      header->version != version_value().value) {
     log_print(Develop,
               "The file {} does be an icpp interpretable object, but its "
               "version doesn't match this icpp (expected {}).",
               path_, version_string());
     return;
   }
-  if (iobject.icpp() != main_program()) {
+  // locate the sections
+  std::string_view isects[IOBJ_SECTION_COUNT];
+  auto dir = reinterpret_cast<const IObjSection *>(header + 1);
+  if (sizeof(IObjHeader) + sizeof(IObjSection) * header->count > fsize) {
+    log_print(Runtime, "Can't load the file {}, it's corrupted.", path_);
+    return;
+  }
+  for (uint32_t i = 0; i < header->count; i++) {
+    if (dir[i].offset > fsize || dir[i].size > fsize - dir[i].offset) {
+      log_print(Runtime, "Can't load the file {}, it's corrupted.", path_);
+      return;
+    }
+    // skip the unknown sections generated by the newer format
+    if (dir[i].type < IOBJ_SECTION_COUNT)
+      isects[dir[i].type] = {base + dir[i].offset, dir[i].size};
+  }
+  // the sections after IOBJ_MANIFEST are optional
+  for (uint32_t i = 0; i <= IOBJ_MANIFEST; i++) {
+    if (!isects[i].data()) {
+      log_print(Runtime, "Can't load the file {}, it's corrupted.", path_);
+      return;
+    }
+  }
+  if (isects[IOBJ_ICPP].data() != main_program()) {
     log_print(Develop,
               "The file {} does be an icpp interpretable object, but its "
               "generator doesn't match this icpp.",
               path_);
     return;
   }
+  auto lazy = header->flags & IOBJ_FLAG_LAZY;
+  if (lazy && !RunConfig::inst()->lazyDecode()) {
+    log_print(Develop,
+              "The file {} does be an icpp interpretable object, but it's "
+              "partially decoded and the lazy decoding is off.",
+              path_);
+    return;
+  }
 
-  // get the original object buffer
-  ofbuf_ = iobject.objbuf();
+  // use the original object buffer in place
+  ofbuf_ = isects[IOBJ_IMAGE];
   auto obuffer = llvm::MemoryBuffer::getMemBuffer(
       llvm::StringRef(ofbuf_.data(), ofbuf_.size()), path, false);
 
@@ -688,46 +1001,124 @@ InterpObject::InterpObject(std::string_view srcpath, std::string_view path)
     return;
   }
   ofile_ = std::move(expObj.get());
-  arch_ = static_cast<ArchType>(iobject.arch());
-  type_ = static_cast<ObjectType>(iobject.otype());
+  arch_ = static_cast<ArchType>(header->arch);
+  type_ = static_cast<ObjectType>(header->otype);
   odiser_.init(ofile_.get(), triple());
 
   // parse from original object
   parseSections();
   parseSymbols();
 
-  auto iins = iobject.instinfos();
-  for (size_t i = 0; i < iins.size(); i++) {
-    auto &iinfs = textsects_[i].iinfs;
-    iinfs.resize(iins[i].infos_size());
-    // copy all the decoed instruction information
-    std::memcpy(&iinfs[0], iins[i].infos().data(),
-                sizeof(InsnInfo) * iinfs.size());
+  // use the decoded instruction informations in place
+  auto texts = iobj_array<IObjText>(isects[IOBJ_TEXTS]);
+  auto islots = iobj_array<uint32_t>(isects[IOBJ_ISLOTS]);
+  insts_ = iobj_array<InsnInfo>(isects[IOBJ_INSTINFOS]);
+  metas_ = iobj_array<uint32_t>(isects[IOBJ_INSTMETAS]);
+  metabuf_ = isects[IOBJ_METABUF];
+  if (texts.size() != textsects_.size() || metas_.size() != insts_.size()) {
+    log_print(Develop,
+              "The file {} does be an icpp interpretable object, but its "
+              "instruction informations are mismatched.",
+              path_);
+    arch_ = Unsupported;
+    return;
+  }
+  if (header->format == iobj_format_wide) {
+    widerelocs_ = iobj_array<uint32_t>(isects[IOBJ_RELOCIDX]);
+    if (widerelocs_.size() != insts_.size()) {
+      log_print(Runtime, "Can't load the file {}, it's corrupted.", path_);
+      arch_ = Unsupported;
+      return;
+    }
+  }
+  for (size_t i = 0; i < texts.size(); i++) {
+    auto &ts = textsects_[i];
+    auto &it = texts[i];
+    if (it.ibegin + it.icount > insts_.size() ||
+        it.sbegin + it.scount > islots.size()) {
+      log_print(Runtime, "Can't load the file {}, it's corrupted.", path_);
+      arch_ = Unsupported;
+      return;
+    }
+    ts.ibegin = it.ibegin;
+    ts.icount = it.icount;
+    ts.islots = islots.subspan(it.sbegin, it.scount);
+  }
+  auto funcs = iobj_array<IObjFunction>(isects[IOBJ_FUNCTIONS]);
+  ifuncs_.assign(funcs.begin(), funcs.end());
+
+  std::vector<std::string_view> imods;
+  for (auto mods = isects[IOBJ_MODULES]; mods.size();) {
+    auto end = mods.find('\0');
+    imods.push_back(mods.substr(0, end));
+    mods = end == std::string_view::npos ? "" : mods.substr(end + 1);
+  }
+  auto symbols = isects[IOBJ_SYMBOLS];
+  auto irefs = iobj_array<IObjReloc>(isects[IOBJ_RELOCS]);
+  // the symbol names are read up to '\0', the last one mustn't run over
+  if (irefs.size() && (symbols.empty() || symbols.back() != '\0')) {
+    log_print(Runtime, "Can't load the file {}, it's corrupted.", path_);
+    arch_ = Unsupported;
+    return;
   }
 
-  auto imetas = iobject.instmetas();
-  for (auto &m : imetas) {
-    // decode base64 key
-    std::string tmpkey(base64::decoded_size(m.first.length()), '\0');
-    auto decret =
-        base64::decode(tmpkey.data(), m.first.data(), m.first.length());
-    // load instruction meta datas
-    idecinfs_.insert({std::string(tmpkey.data(), decret.first), m.second});
+  // the bases of the prelinked modules which are unchanged since prelinking,
+  // the relocations referencing them are rebased without the symbol lookups
+  std::vector<uint64_t> pbases(imods.size(), prelink_none);
+  std::span<const uint64_t> poffsets;
+  auto prelink = isects[IOBJ_PRELINK];
+  if (prelink.size() >= sizeof(IObjPrelink)) {
+    auto count = reinterpret_cast<const IObjPrelink *>(prelink.data())->count;
+    auto pmods = iobj_array<IObjPrelinkModule>(
+        prelink.substr(sizeof(IObjPrelink)));
+    if (count <= pmods.size()) {
+      poffsets = iobj_array<uint64_t>(prelink.substr(
+          sizeof(IObjPrelink) + count * sizeof(IObjPrelinkModule)));
+      pmods = pmods.first(count);
+    }
+    if (poffsets.size() != irefs.size())
+      pmods = {};
+    for (auto &pm : pmods) {
+      IObjPrelinkModule cur{};
+      if (pm.module == 0 || pm.module >= imods.size() ||
+          !prelink_stat(imods[pm.module], cur) || cur.size != pm.size ||
+          cur.mtime != pm.mtime)
+        continue;
+      Loader loader(imods[pm.module]);
+      if (loader.valid())
+        pbases[pm.module] = Loader::moduleBase(imods[pm.module]);
+    }
   }
 
-  auto imods = iobject.modules();
-  auto irefs = iobject.irefsyms();
   for (auto &r : irefs) {
+    if (r.module >= imods.size() || r.symbol >= symbols.size()) {
+      log_print(Runtime, "Can't load the file {}, it's corrupted.", path_);
+      arch_ = Unsupported;
+      return;
+    }
+    std::string_view symbol{symbols.data() + r.symbol};
     // dependent module
-    auto module = imods[r.module()];
+    auto module = imods[r.module];
     if (module == "self") {
       uint64_t basevm =
-          r.dindex() == -1
+          r.dindex == -1
               ? textsects_[0].vm
-              : reinterpret_cast<uint64_t>(dynsects_[r.dindex()].buffer.data());
+              : reinterpret_cast<uint64_t>(dynsects_[r.dindex].buffer.data());
       irelocs_.push_back(RelocInfo{
-          r.symbol(), reinterpret_cast<void *>((int64_t)(int)r.rva() + basevm),
-          r.type()});
+          symbol, reinterpret_cast<void *>((int64_t)(int)r.rva + basevm),
+          r.type});
+      continue;
+    }
+    auto pi = &r - irefs.data();
+    if (pbases[r.module] != prelink_none && poffsets[pi] != prelink_none) {
+      auto target =
+          reinterpret_cast<const void *>(pbases[r.module] + poffsets[pi]);
+      if (r.type == CSymbolRef::ST_Data) {
+        // the data relocation refers to the symbol cache slot
+        Loader::cacheSymbol(symbol, target);
+        target = Loader::locateSymbol(symbol, true);
+      }
+      irelocs_.push_back(RelocInfo{symbol, target, r.type});
       continue;
     }
     Loader loader(module);
@@ -736,20 +1127,27 @@ InterpObject::InterpObject(std::string_view srcpath, std::string_view path)
       arch_ = Unsupported;
       return;
     }
-    auto data = r.type() == CSymbolRef::ST_Data;
+    auto data = r.type == CSymbolRef::ST_Data;
     if (loader.valid()) {
       // resolve this symbol in the current module
-      auto target = loader.locate(r.symbol(), data);
+      auto target = loader.locate(symbol, data);
       // if fail then abort, never return
       if (!target)
-        target = Loader::locateSymbol(r.symbol(), data);
-      irelocs_.push_back(RelocInfo{r.symbol(), target, r.type()});
+        target = Loader::locateSymbol(symbol, data);
+      irelocs_.push_back(RelocInfo{symbol, target, r.type});
     } else {
       // the final chance to resolve this symbol, abort if fails
-      irelocs_.push_back(RelocInfo{
-          r.symbol(), Loader::locateSymbol(r.symbol(), data), r.type()});
+      irelocs_.push_back(
+          RelocInfo{symbol, Loader::locateSymbol(symbol, data), r.type});
     }
   }
+  if (lazy && !initLazily(texts, islots)) {
+    log_print(Runtime, "Can't load the file {}, it's corrupted.", path_);
+    arch_ = Unsupported;
+    return;
+  }
+  classifyRelocs();
+  buildSuperblocks();
 }
 
 InterpObject::~InterpObject() {}
@@ -770,11 +1168,23 @@ bool InterpObject::belong(uint64_t vm, size_t *di) {
   return false;
 }
 
+std::vector<AddressRange> InterpObject::memoryRanges() {
+  std::vector<AddressRange> ranges;
+  auto start = reinterpret_cast<uint64_t>(ofbuf_.data());
+  ranges.push_back({start, start + ofbuf_.length()});
+  for (auto &s : dynsects_) {
+    start = reinterpret_cast<uint64_t>(s.buffer.data());
+    ranges.push_back({start, start + s.buffer.size()});
+  }
+  return ranges;
+}
+
 SymbolHash::SymbolHash(std::string_view path) : Object("", path) {}
 
 SymbolHash::~SymbolHash() {}
 
-std::vector<uint32_t> SymbolHash::hashes(std::string &message) {
+std::vector<uint32_t> SymbolHash::hashes(std::string &message,
+                                         std::string *names) {
   std::vector<uint32_t> result;
   auto errBuff = llvm::MemoryBuffer::getFile(path_);
   if (!errBuff) {
@@ -817,6 +1227,17 @@ std::vector<uint32_t> SymbolHash::hashes(std::string &message) {
     }
     result.resize(sorted.size());
     std::copy(sorted.begin(), sorted.end(), result.begin());
+    if (names) {
+      std::set<std::string_view> sortednames;
+      for (auto &sym : funcs_)
+        sortednames.insert(sym.first);
+      for (auto &sym : datas_)
+        sortednames.insert(sym.first);
+      for (auto name : sortednames) {
+        names->append(name);
+        names->push_back('\0');
+      }
+    }
   } else {
     message = std::format("Failed to create llvm object: {}.",
                           llvm::toString(std::move(expObj.takeError())));
@@ -7,15 +7,18 @@
 #pragma once
 
 #include "arch.h"
+#include <atomic>
 #include <cassert>
 #include <map>
 #include <memory>
+#include <span>
 #include <string>
 #include <string_view>
 #include <unordered_map>
 #include <vector>
 
 namespace llvm {
+class MCDisassembler;
 class MemoryBuffer;
 class StringRef;
 namespace object {
@@ -24,6 +27,9 @@ class ObjectFile;
 namespace objdump {
 class SourcePrinter;
 }
+namespace sys::fs {
+class mapped_file_region;
+}
 } // namespace llvm
 
 using CObjectFile = llvm::object::ObjectFile;
@@ -33,6 +39,131 @@ namespace icpp {
 constexpr const uint32_t iobj_magic{'jboi'};
 constexpr const std::string_view iobj_ext{".io"};
 constexpr const std::string_view obj_ext{".o"};
+// dependency manifest of the compiled object, see IObjManifest
+constexpr const std::string_view imf_ext{".mf"};
+constexpr const uint32_t imeta_none{static_cast<uint32_t>(-1)};
+constexpr const uint32_t islot_none{static_cast<uint32_t>(-1)};
+// the lazily decoded meta datas are stored in blocks of this size
+constexpr const uint32_t lazy_block_shift{16};
+constexpr const uint32_t lazy_block_size{1 << lazy_block_shift};
+
+// the flat layout version of .io file
+constexpr const uint32_t iobj_format{4};
+// the extended layout version of .io file whose instructions refer to
+// IOBJ_RELOCIDX, the compact objects keep using iobj_format
+constexpr const uint32_t iobj_format_wide{5};
+
+// .io file layout: [IObjHeader, IObjSection * count, section datas],
+// each section is aligned so that it can be used in place after the whole
+// file is mapped
+enum IObjSectionType : uint32_t {
+  IOBJ_ICPP,      // cache file generator main program path
+  IOBJ_TEXTS,     // IObjText of each text section
+  IOBJ_INSTINFOS, // InsnInfo of all the text sections
+  IOBJ_INSTMETAS, // meta data offset in IOBJ_METABUF of each instruction
+  IOBJ_ISLOTS,    // dense instruction index of all the text sections
+  IOBJ_METABUF,   // decoded instruction operand meta datas
+  IOBJ_MODULES,   // '\0' terminated module list referenced by relocations
+  IOBJ_RELOCS,    // IObjReloc of each relocation
+  IOBJ_SYMBOLS,   // '\0' terminated relocation symbol names
+  IOBJ_IMAGE,     // the original object buffer
+  IOBJ_MANIFEST,  // IObjManifest of the source, empty for the module object
+  IOBJ_PRELINK,   // IObjPrelink of the external relocations, optional
+  IOBJ_FUNCTIONS, // IObjFunction of each decoded function, optional
+  IOBJ_RELOCIDX,  // reloc index of each instruction, only in iobj_format_wide
+  IOBJ_SECTION_COUNT,
+};
+
+enum IObjFlags : uint32_t {
+  // only the decoded instructions of a lazily decoded object are cached, the
+  // others are decoded on demand after loading
+  IOBJ_FLAG_LAZY = 1,
+};
+
+struct IObjHeader {
+  uint32_t magic;   // iobj_magic
+  uint32_t format;  // iobj_format
+  uint32_t version; // icpp version
+  uint16_t arch;
+  uint16_t otype;
+  uint32_t count; // section count
+  uint32_t flags; // IObjFlags
+};
+
+struct IObjSection {
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t offset; // file offset
+  uint64_t size;
+};
+
+struct IObjText {
+  uint32_t ibegin; // instruction index in IOBJ_INSTINFOS
+  uint32_t icount;
+  uint32_t sbegin; // slot index in IOBJ_ISLOTS
+  uint32_t scount;
+};
+
+struct IObjReloc {
+  uint32_t module; // module index
+  uint32_t rva;    // symbol file buffer rva from text[0] section
+  uint32_t type;   // symbol type
+  uint32_t dindex; // dynamical section index
+  uint32_t symbol; // symbol name offset in IOBJ_SYMBOLS
+  uint32_t reserved;
+};
+
+// a decoded function, its instructions are reused by the next decoding if
+// its content is unchanged after recompiling the source
+struct IObjFunction {
+  uint64_t hash;   // content hash of the function opcodes
+  uint32_t rva;    // function file buffer rva from text[0] section
+  uint32_t size;   // function opcodes size
+  uint32_t ibegin; // instruction index in IOBJ_INSTINFOS
+  uint32_t icount;
+};
+
+// prelink layout: [IObjPrelink, IObjPrelinkModule * count,
+// uint64_t * relocation count], the external relocation target is rebased
+// from the offset in its module if this module is unchanged, or resolved by
+// its symbol name if it's prelink_none
+constexpr const uint64_t prelink_none{static_cast<uint64_t>(-1)};
+
+struct IObjPrelink {
+  uint32_t count; // prelinked module count
+  uint32_t reserved;
+};
+
+struct IObjPrelinkModule {
+  uint32_t module; // module index in IOBJ_MODULES
+  uint32_t reserved;
+  uint64_t size; // module file size
+  int64_t mtime; // module file modification time
+};
+
+// dependency manifest layout: [IObjManifest, IObjDepend + path...], each path
+// is '\0' padded to 8 bytes aligned
+struct IObjManifest {
+  uint64_t key;   // hash of the flags and all the dependency contents
+  uint64_t flags; // hash of the icpp version, compiling flags and -I dirs
+  uint32_t count; // dependency count, the source itself is the first one
+  uint32_t reserved;
+};
+
+struct IObjDepend {
+  uint64_t size;
+  int64_t mtime;
+  uint64_t hash;     // content hash
+  uint32_t pathsize; // path string size
+  uint32_t reserved;
+};
+
+// read a section of the .io file without loading it, return an empty string
+// if it doesn't exist or the file isn't compatible
+std::string iobj_section(std::string_view path, IObjSectionType type);
+
+// read the dependency manifest of a .io file without loading it
+std::string iobj_manifest(std::string_view path);
 
 struct InsnInfo {
   uint32_t type : 8,    // instruction type
@@ -47,6 +178,78 @@ struct InsnInfo {
   bool operator>(const InsnInfo &right) const { return rva > right.rva; }
 };
 
+// InsnInfo::reloc of the instruction whose relocation index doesn't fit in
+// 18 bits, the real index is in the wide relocation table of its object
+constexpr const uint32_t insn_reloc_wide{(1 << 18) - 1};
+// the text sections must be within this range to be encoded by InsnInfo::rva
+constexpr const uint64_t insn_rva_limit{1ULL << 31};
+
+// whether the instruction can be emulated by unicorn directly
+inline bool can_emulate(const InsnInfo *inst) {
+  switch (inst->type) {
+  case INSN_CONDJUMP:
+  case INSN_ARM64_RETURN:
+  case INSN_ARM64_SYSCALL:
+  case INSN_ARM64_CALL:
+  case INSN_ARM64_CALLREG:
+  case INSN_ARM64_JUMP:
+  case INSN_ARM64_JUMPREG:
+  case INSN_X64_RETURN:
+  case INSN_X64_SYSCALL:
+  case INSN_X64_CALL:
+  case INSN_X64_CALLREG:
+  case INSN_X64_CALLMEM:
+  case INSN_X64_JUMP:
+  case INSN_X64_JUMPCOND:
+  case INSN_X64_JUMPREG:
+  case INSN_X64_JUMPMEM:
+  case INSN_X64_CMP8MI:
+  case INSN_X64_CMP8MI8:
+  case INSN_X64_CMP16MI:
+  case INSN_X64_CMP16MI8:
+  case INSN_X64_CMP32MI:
+  case INSN_X64_CMP32MI8:
+  case INSN_X64_CMP64MI32:
+  case INSN_X64_CMP64MI8:
+  case INSN_X64_CMP8RM:
+  case INSN_X64_CMP16RM:
+  case INSN_X64_CMP32RM:
+  case INSN_X64_CMP64RM:
+  case INSN_X64_CMP8MR:
+  case INSN_X64_CMP16MR:
+  case INSN_X64_CMP32MR:
+  case INSN_X64_CMP64MR:
+  case INSN_X64_TEST8MI:
+  case INSN_X64_TEST8MR:
+  case INSN_X64_TEST16MI:
+  case INSN_X64_TEST16MR:
+  case INSN_X64_TEST32MI:
+  case INSN_X64_TEST32MR:
+  case INSN_X64_TEST64MI32:
+  case INSN_X64_TEST64MR:
+    return false;
+  case INSN_HARDWARE:
+    return true;
+  default:
+    // if the current instruction contains relocation or non-code
+    // segment register, then it must be interpreted otherwise can
+    // be emulated.
+#if ARCH_X64
+    if (inst->segflag)
+      return false;
+#endif
+    return inst->rflag == 0;
+  }
+}
+
+// host call type of the relocation target
+enum RelocCallType : uint32_t {
+  RCALL_UNKNOWN, // unclassified, check it dynamically when calling
+  RCALL_GENERIC, // host function whose arguments may be callbacks
+  RCALL_LEAF,    // host function which never calls back to the script
+  RCALL_SPECIAL, // host function which needs special processing, e.g.: exit
+};
+
 struct RelocInfo {
   RelocInfo() = delete;
   RelocInfo(std::string_view n, const void *p, uint32_t t)
@@ -58,6 +261,8 @@ struct RelocInfo {
   // converted from relocation type
   // e.g.: arm64 GOT reloc ==> ST_DATA, otherwise ST_FUNCTION, etc.
   uint32_t type;
+  // host call type of the target, see RelocCallType
+  uint32_t ctype = RCALL_UNKNOWN;
 
   const void *realTarget();
 };
@@ -76,8 +281,20 @@ struct TextSection {
   uint32_t frva; // file buffer rva from .text[0]
   uint64_t vrva; // vm address rva like in VMPStudio and IDA
   uint64_t vm;   // runtime address in iobject instance
-  // instruction informations
-  std::vector<InsnInfo> iinfs;
+  // instruction informations range in Object::insts_
+  uint32_t ibegin = 0;
+  uint32_t icount = 0;
+  // dense instruction index, islots[(rva - frva) >> islot_shift] is the
+  // instruction index in Object::insts_, islot_none if it isn't a boundary,
+  // it refers to either islotbuf or the mapped .io file
+  std::span<const uint32_t> islots;
+  std::vector<uint32_t> islotbuf;
+};
+
+// a half open address range [start, end)
+struct AddressRange {
+  uint64_t start;
+  uint64_t end;
 };
 
 struct StubSpot {
@@ -87,7 +304,27 @@ struct StubSpot {
   std::string_view name; // symbol name
 };
 
+// the table of zero filled trivial elements whose pages are only backed on
+// their first touch, e.g.: the lazily decoded instruction slots
+struct PagesDeleter {
+  size_t size = 0;
+
+  // the zero filled pages of size bytes, nullptr if failed
+  static void *alloc(size_t size);
+  void operator()(const void *pages);
+};
+template <typename T> using PagesTable = std::unique_ptr<T[], PagesDeleter>;
+
+template <typename T> PagesTable<T> pages_table(size_t count) {
+  PagesDeleter deleter{count * sizeof(T)};
+  return PagesTable<T>(static_cast<T *>(PagesDeleter::alloc(deleter.size)),
+                       deleter);
+}
+
 class DisassemblerTarget;
+struct DecodeChunk;
+struct DecodeReuse;
+struct LazyDecoder;
 
 struct ObjectDisassembler {
   ObjectDisassembler() {}
@@ -99,6 +336,7 @@ struct ObjectDisassembler {
   // so raw pointer used, we manage them manually
   DisassemblerTarget *DT = nullptr;
   ::llvm::objdump::SourcePrinter *SP = nullptr;
+  LazyDecoder *LD = nullptr;
 };
 
 class Object {
@@ -120,42 +358,120 @@ public:
   uint64_t vm2rva(uint64_t vm, size_t *ti = nullptr);
   // vm to virtual address rva like in VMPStudio and IDA
   uint64_t vm2vrva(uint64_t vm);
+  // the reverse of vm2vrva
+  uint64_t vrva2vm(uint64_t vrva);
 
   // check whether vm belongs to text section
   bool executable(uint64_t vm, Object **iobject);
   // check whether vm belongs to the whole memory buffer of this object
   virtual bool belong(uint64_t vm, size_t *di = nullptr);
   virtual std::string cachePath();
+  // the address ranges of the text sections
+  std::vector<AddressRange> textRanges();
+  // the address ranges of the whole memory buffer and dynamic sections
+  virtual std::vector<AddressRange> memoryRanges();
 
   const char *triple();
   const void *locateSymbol(std::string_view name);
   const void *relocTarget(size_t i);
+  uint32_t relocCallType(size_t i) { return irelocs_[i].ctype; }
+  // the relocation index of the relocated instruction
+  uint32_t relocIndex(const InsnInfo *inst) {
+    return inst->reloc == insn_reloc_wide ? widerelocs_[inst - insts_.data()]
+                                          : inst->reloc;
+  }
+  const void *relocTarget(const InsnInfo *inst) {
+    return relocTarget(relocIndex(inst));
+  }
+  uint32_t relocCallType(const InsnInfo *inst) {
+    return relocCallType(relocIndex(inst));
+  }
 
-  template <typename T> const T *metaInfo(const InsnInfo *inst, uint64_t vm) {
-    auto found =
-        idecinfs_.find(std::string(reinterpret_cast<char *>(vm), inst->len));
-    assert(found != idecinfs_.end() && "Null meta information is impossiple.");
-    return reinterpret_cast<T *>(found->second.data());
+  // whether this instruction should be interpreted in superblock mode,
+  // unicorn runs across all the others
+  bool superblockExit(const InsnInfo *inst) {
+    return sbexits_[inst - insts_.data()];
+  }
+  // addresses of the instructions which unicorn must stop at
+  const std::vector<uint64_t> &superblockExits() { return sbexitvms_; }
+
+  template <typename T> const T *metaInfo(const InsnInfo *inst) {
+    auto offset = metas_[inst - insts_.data()];
+    assert(offset != imeta_none && "Null meta information is impossiple.");
+    if (lazy_)
+      return reinterpret_cast<const T *>(
+          lazyblocks_[offset >> lazy_block_shift] +
+          (offset & (lazy_block_size - 1)));
+    return reinterpret_cast<const T *>(&metabuf_[offset]);
   }
 
+  // whether the instructions are decoded on their first execution
+  constexpr bool lazy() { return lazy_; }
+  // whether the .io cache misses some lazily decoded instructions
+  bool cacheOutdated() { return lazy_ && lazydirty_; }
+  // whether a .io cache can still be generated from this object, it can't
+  // after its object file has been removed
+  bool cacheable() { return cacheable_; }
+  void disableCache() { cacheable_ = false; }
+
   const void *mainEntry();
   std::vector<const void *> ctorEntries();
   std::vector<const void *> dtorEntries();
   const InsnInfo *insnInfo(uint64_t vm);
+  // the published instruction at vm in lazy mode without decoding it, nullptr
+  // if it's outside of the text sections or hasn't been decoded yet
+  const InsnInfo *decodedInsn(uint64_t vm);
   std::string sourceInfo(uint64_t vm);
+  // the nearest function symbol which vm belongs to
+  std::string_view functionName(uint64_t vm);
   std::string generateCache();
   void dump();
 
+  // save the runtime writable contents, e.g.: data sections, so that this
+  // object can be rerun from a clean state after restore
+  void snapshot();
+  void restore();
+  // the approximate memory usage in bytes of this object
+  uint64_t memoryUsage();
+
 protected:
   void createFromMemory(ObjectType type);
   void createFromFile(ObjectType type);
   void parseSymbols();
   void parseSections();
-  void decodeInsns(TextSection &text);
-  void decodeInsns() {
-    for (auto &s : textsects_)
-      decodeInsns(s);
-  }
+  // <opcodes, meta offset> used to share the same meta data when decoding
+  typedef std::unordered_map<std::string_view, uint32_t> MetaCache;
+  void decodeInsns();
+  // decode a text section range on the decoding thread, it mustn't touch
+  // the object states shared with the others
+  void decodeChunk(DecodeChunk &chunk, llvm::MCDisassembler &disasm);
+  // merge the chunk to the object wide decoding buffers and relocations
+  void mergeChunk(DecodeChunk &chunk, MetaCache &metas);
+  // resolve the relocation of the instruction at opc, return its index in
+  // irelocs_
+  uint32_t relocateInsn(uint64_t opc, const void *prsym, uint32_t symtype);
+  // set the relocation index of the index instruction, the ones too large for
+  // InsnInfo::reloc go to the wide relocation table
+  void setReloc(InsnInfo &inst, size_t index, uint32_t reloc);
+  // build the dense rva to instruction index of this text section
+  void indexInsns(TextSection &text);
+  // prepare for decoding on demand, the instruction index is the slot index
+  // of all the text sections, the decoded ones of a .io cache are imported
+  bool initLazily(std::span<const IObjText> texts = {},
+                  std::span<const uint32_t> islots = {});
+  // decode the function which contains vm in the ti text section
+  void decodeLazily(size_t ti, uint64_t vm);
+  // publish the lazily decoded chunk to the readers
+  void publishChunk(DecodeChunk &chunk);
+  // the compact instruction informations of the lazily decoded ones
+  void compactInsns(std::vector<IObjText> &texts, std::vector<uint32_t> &islots,
+                    std::vector<InsnInfo> &insts, std::vector<uint32_t> &metas,
+                    std::string &metabuf, std::vector<uint32_t> &wides);
+  // classify the host call type of the relocation targets from begin
+  void classifyRelocs(size_t begin = 0);
+  // resolve the inner branches and collect the superblock exits
+  void buildSuperblocks();
+  constexpr uint32_t islotShift() { return arch_ == AArch64 ? 2 : 0; }
 
   void relocateData(uint32_t index, const llvm::StringRef &content,
                     uint64_t offset, const void *rsym);
@@ -176,14 +492,57 @@ protected:
   std::vector<TextSection> textsects_;
   // dynamically allocated sections
   std::vector<DynSection> dynsects_;
-  // instruction decoded informations from machine opcode
-  // <opcodes, decodes>
-  std::map<std::string, std::string> idecinfs_;
+  // instruction informations of all the text sections
+  std::span<const InsnInfo> insts_;
+  // instruction decoded operand meta datas from machine opcode,
+  // metas_[i] is the offset in metabuf_ of insts_[i], imeta_none if nothing
+  std::span<const uint32_t> metas_;
+  std::string_view metabuf_;
+  // the decoding buffers which the above views refer to, they're empty if
+  // the views refer to the mapped .io file
+  std::vector<InsnInfo> iinfs_;
+  std::vector<uint32_t> imetas_;
+  std::string imetabuf_;
+  // widerelocs_[i] is the relocation index of insts_[i] if its reloc is
+  // insn_reloc_wide, it's empty for the compact objects
+  std::span<const uint32_t> widerelocs_;
+  std::vector<uint32_t> iwiderelocs_;
+  // the decoded functions, they're empty if it's decoded lazily
+  std::vector<IObjFunction> ifuncs_;
+  // lazy decoding states, lazyflags_[i] is set after insts_[i] is published,
+  // the meta offset is (block << lazy_block_shift | offset) in lazyblocks_
+  bool lazy_ = false;
+  bool lazydirty_ = false;
+  PagesTable<std::atomic<bool>> lazyflags_;
+  PagesTable<const char *> lazyblocks_;
+  // superblock mode exit flags of insts_ and their vm addresses
+  std::vector<bool> sbexits_;
+  std::vector<uint64_t> sbexitvms_;
   // instruction relocations
   std::vector<RelocInfo> irelocs_;
+  // <target, type> to the index in irelocs_ of the first relocation of them,
+  // irelocs_[0, relocindexed_) are indexed
+  struct RelocKey {
+    const void *target;
+    uint32_t type;
+
+    bool operator==(const RelocKey &right) const = default;
+  };
+  struct RelocKeyHash {
+    size_t operator()(const RelocKey &key) const {
+      return std::hash<const void *>{}(key.target) ^ key.type;
+    }
+  };
+  std::unordered_map<RelocKey, uint32_t, RelocKeyHash> relocindex_;
+  size_t relocindexed_ = 0;
   // data section spots which contain pointer in text section,
   // they'll be redirect to dynamic stub created by ExecEngine
   std::vector<StubSpot> stubspots_;
+  // whether generateCache can read the original object file
+  bool cacheable_ = true;
+  // the contents saved by snapshot
+  std::string snapimage_;
+  std::vector<std::string> snapdyns_;
 };
 
 class MachOObject : public Object {
@@ -270,9 +629,12 @@ public:
 
   bool belong(uint64_t vm, size_t *di) override;
   std::string cachePath() override { return path_; }
+  std::vector<AddressRange> memoryRanges() override;
 
 private:
-  std::string ofbuf_; // .o file buffer copied from .io file
+  // the whole .io file mapped in copy-on-write mode
+  std::unique_ptr<::llvm::sys::fs::mapped_file_region> region_;
+  std::string_view ofbuf_; // .o file buffer in the mapped .io file
 };
 
 class SymbolHash : public Object {
@@ -280,7 +642,10 @@ public:
   SymbolHash(std::string_view path);
   virtual ~SymbolHash();
 
-  std::vector<uint32_t> hashes(std::string &message);
+  // the sorted symbol hashes, and their '\0' terminated names if names isn't
+  // nullptr
+  std::vector<uint32_t> hashes(std::string &message,
+                               std::string *names = nullptr);
 };
 
 std::shared_ptr<Object> create_object(std::string_view srcpath,
@@ -101,6 +101,17 @@ static inline void page_executable(const void *page) {
   page_protect(page, PAGE_EXECUTE_READ);
 }
 
+// allocate the zero filled memory of size bytes, the pages are only backed by
+// the physical memory on their first touch
+static inline void *pages_alloc(size_t size) {
+  return ::VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE,
+                        PAGE_READWRITE);
+}
+
+static inline void pages_free(const void *pages, size_t size) {
+  ::VirtualFree(const_cast<void *>(pages), 0, MEM_RELEASE);
+}
+
 extern "C" {
 void _CxxThrowException(void);
 
@@ -141,6 +152,20 @@ extern "C" void sys_icache_invalidate(const void *start, size_t len);
 static inline void page_flush(const void *page) {
   sys_icache_invalidate(page, mem_page_size);
 }
+
+// allocate the zero filled memory of size bytes, the pages are only backed by
+// the physical memory on their first touch
+static inline void *pages_alloc(size_t size) {
+  vm_address_t pages;
+  if (vm_allocate(mach_task_self(), &pages, size, VM_FLAGS_ANYWHERE) !=
+      KERN_SUCCESS)
+    return nullptr;
+  return reinterpret_cast<void *>(pages);
+}
+
+static inline void pages_free(const void *pages, size_t size) {
+  vm_deallocate(mach_task_self(), reinterpret_cast<vm_address_t>(pages), size);
+}
 #else
 #define mem_page_size getpagesize()
 
@@ -159,6 +184,18 @@ static inline void page_flush(const void *page) {
   __builtin___clear_cache(start, start + mem_page_size);
 }
 
+// allocate the zero filled memory of size bytes, the pages are only backed by
+// the physical memory on their first touch
+static inline void *pages_alloc(size_t size) {
+  auto pages = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  return pages == MAP_FAILED ? nullptr : pages;
+}
+
+static inline void pages_free(const void *pages, size_t size) {
+  munmap(const_cast<void *>(pages), size);
+}
+
 #endif // end of __APPLE__
 
 static inline void page_writable(const void *page) {
@@ -5,5 +5,167 @@
 */
 
 #include "profile.h"
+#include "loader.h"
+#include "object.h"
+#include "runcfg.h"
+#include "utils.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <llvm/Demangle/Demangle.h>
 
-namespace icpp {}
+namespace fs = std::filesystem;
+
+namespace icpp {
+
+Profiler *Profiler::inst() {
+  static std::unique_ptr<Profiler> profiler = []() {
+    auto interval = RunConfig::inst()->profileInterval();
+    return interval > 0 ? std::make_unique<Profiler>(
+                              interval, RunConfig::inst()->profileOutput())
+                        : nullptr;
+  }();
+  return profiler.get();
+}
+
+Profiler::Profiler(int interval, std::string_view output) : output_(output) {
+  ticker_ = std::thread([this, interval]() {
+    while (!stop_.load(std::memory_order_relaxed)) {
+      std::this_thread::sleep_for(std::chrono::microseconds(interval));
+      tick_.fetch_add(1, std::memory_order_relaxed);
+    }
+  });
+}
+
+Profiler::~Profiler() {
+  stop_ = true;
+  if (ticker_.joinable())
+    ticker_.join();
+  // the samples of the script threads which were still running when the main
+  // engine collected, their engines keep the sampled objects alive
+  collect();
+  report();
+}
+
+Profiler::Samples *Profiler::threadSamples() {
+  thread_local Samples *samples = nullptr;
+  if (!samples) {
+    std::lock_guard lock(mutex_);
+    threads_.push_back(std::make_unique<Samples>());
+    samples = threads_.back().get();
+    samples->index = threads_.size() - 1;
+  }
+  return samples;
+}
+
+void Profiler::sample(const std::vector<Frame> &frames, uint64_t weight) {
+  auto samples = threadSamples();
+  std::lock_guard lock(samples->mutex);
+  samples->counts[frames] += weight;
+}
+
+// extract the "file:line" part from the output of Object::sourceInfo
+static std::string source_line(std::string_view info) {
+  while (info.size()) {
+    auto end = info.find('\n');
+    auto line = info.substr(0, end);
+    info = end == std::string_view::npos ? "" : info.substr(end + 1);
+    if (line.starts_with("; "))
+      line = line.substr(2);
+    auto colon = line.rfind(':');
+    if (colon == std::string_view::npos || colon + 1 == line.size())
+      continue;
+    auto lineno = line.substr(colon + 1);
+    if (std::all_of(lineno.begin(), lineno.end(),
+                    [](char c) { return '0' <= c && c <= '9'; })) {
+      return fs::path(line.substr(0, colon)).filename().string() + ":" +
+             std::string(lineno);
+    }
+  }
+  return "";
+}
+
+void Profiler::collect() {
+  std::lock_guard lock(mutex_);
+
+  // take away the raw samples of each thread
+  std::vector<std::pair<int, std::map<std::vector<Frame>, uint64_t>>> raws;
+  for (auto &t : threads_) {
+    std::lock_guard tlock(t->mutex);
+    if (t->counts.size())
+      raws.push_back({t->index, std::move(t->counts)});
+    t->counts.clear();
+  }
+
+  // symbolize the frames in ascending address order, as the source printer
+  // outputs nothing for the same line as the last one
+  std::map<Frame, std::pair<std::string, std::string>> symbols;
+  for (auto &r : raws) {
+    for (auto &c : r.second) {
+      for (auto &f : c.first)
+        symbols.insert({f, {}});
+    }
+  }
+  Object *lastobj = nullptr;
+  std::string lastline;
+  for (auto &s : symbols) {
+    auto object = s.first.object;
+    auto addr = s.first.addr;
+    if (!object) {
+      // host function
+      s.second.first =
+          std::format("{}!{:x}",
+                      fs::path(Loader::locateModule(
+                                   reinterpret_cast<const void *>(addr)))
+                          .filename()
+                          .string(),
+                      addr);
+      continue;
+    }
+    auto name = object->functionName(addr);
+    s.second.first = name.size() ? llvm::demangle(name)
+                                 : std::format("{:x}", object->vm2vrva(addr));
+    // ';' is the frame separator of the folded stack
+    std::replace(s.second.first.begin(), s.second.first.end(), ';', ':');
+    auto info = object->sourceInfo(addr);
+    if (info.size() || object != lastobj)
+      lastline = source_line(info);
+    lastobj = object;
+    s.second.second = lastline;
+  }
+
+  // fold the stacks as "thread;outermost;...;innermost count"
+  for (auto &r : raws) {
+    for (auto &c : r.second) {
+      auto folded = std::format("thread-{}", r.first);
+      for (auto it = c.first.rbegin(); it != c.first.rend(); it++) {
+        auto &symbol = symbols[*it];
+        folded += ";" + symbol.first;
+        if (it + 1 == c.first.rend() && symbol.second.size())
+          folded += " [" + symbol.second + "]";
+      }
+      folded_[folded] += c.second;
+    }
+  }
+}
+
+void Profiler::report() {
+  std::lock_guard lock(mutex_);
+  if (folded_.empty())
+    return;
+  std::ofstream outf(output_, std::ios::trunc);
+  if (!outf.is_open()) {
+    log_print(Runtime, "Failed to write the profiling result to '{}'.",
+              output_);
+    return;
+  }
+  uint64_t total = 0;
+  for (auto &f : folded_) {
+    outf << f.first << " " << f.second << "\n";
+    total += f.second;
+  }
+  log_print(Runtime, "Wrote {} profiling samples to '{}'.", total, output_);
+}
+
+} // namespace icpp
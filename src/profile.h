@@ -6,4 +6,78 @@
 
 #pragma once
 
-namespace icpp {}
+#include <atomic>
+#include <compare>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace icpp {
+
+class Object;
+
+/*
+sampling profiler of the interpreted code, it's enabled by the
+"vm_profile_interval" of the running configuration.
+
+the ticker thread increases the tick at each interval, the execution engine
+of each thread takes a sample when it notices a new tick, the stack of the
+sample is made up of the interpreted pc or host call target and the return
+addresses walked through the frame pointer chain.
+*/
+class Profiler {
+public:
+  // a stack frame, object is nullptr for the host one
+  struct Frame {
+    Object *object;
+    uint64_t addr;
+
+    auto operator<=>(const Frame &right) const = default;
+  };
+
+  // the profiler instance, nullptr if profiling is off
+  static Profiler *inst();
+
+  Profiler(int interval, std::string_view output);
+  ~Profiler();
+
+  uint64_t tick() { return tick_.load(std::memory_order_relaxed); }
+
+  // record a sample with its weight(elapsed ticks) for the current thread,
+  // frames[0] is the innermost one
+  void sample(const std::vector<Frame> &frames, uint64_t weight);
+
+  // symbolize the samples taken so far, it must be called before the sampled
+  // objects are released
+  void collect();
+
+private:
+  // write the collected samples to the output file in folded stack format,
+  // which flamegraph.pl, speedscope, etc. accept, it's done once when the
+  // profiler stops at exit
+  void report();
+
+  struct Samples {
+    int index;
+    std::mutex mutex;
+    std::map<std::vector<Frame>, uint64_t> counts;
+  };
+  Samples *threadSamples();
+
+  std::string output_;
+  std::atomic<uint64_t> tick_{0};
+  std::atomic<bool> stop_{false};
+  std::thread ticker_;
+
+  std::mutex mutex_;
+  // raw samples of each thread
+  std::vector<std::unique_ptr<Samples>> threads_;
+  // symbolized samples reported so far, <folded stack, count>
+  std::map<std::string, uint64_t> folded_;
+};
+
+} // namespace icpp
@@ -7,6 +7,7 @@
 #include "runcfg.h"
 #include "utils.h"
 #include <boost/json.hpp>
+#include <algorithm>
 #include <cstdio>
 #include <fstream>
 #include <memory>
@@ -19,6 +20,17 @@ namespace icpp {
 constexpr const std::string_view key_debugger = "vm_debugger";
 constexpr const std::string_view key_stacksize = "vm_stack_size";
 constexpr const std::string_view key_stepsize = "uc_step_size";
+constexpr const std::string_view key_superblock = "uc_superblock";
+constexpr const std::string_view key_poolsize = "uc_pool_size";
+constexpr const std::string_view key_poolwarm = "uc_pool_warm";
+constexpr const std::string_view key_profinterval = "vm_profile_interval";
+constexpr const std::string_view key_profoutput = "vm_profile_output";
+constexpr const std::string_view key_trace = "vm_trace";
+constexpr const std::string_view key_traceoutput = "vm_trace_output";
+constexpr const std::string_view key_tracesize = "vm_trace_size";
+constexpr const std::string_view key_snippetcache = "vm_snippet_cache";
+constexpr const std::string_view key_snippetdisk = "vm_snippet_disk_cache";
+constexpr const std::string_view key_lazydecode = "vm_lazy_decode";
 
 bool RunConfig::repl = false;
 bool RunConfig::gadget = false;
@@ -79,13 +91,142 @@ RunConfig::RunConfig(const char *cfg) {
         log_print(Runtime, "The value of '{}' must be an int value.",
                   key_stepsize);
     }
+    if (object.contains(key_superblock)) {
+      auto value = object.at(key_superblock);
+      if (value.is_bool())
+        superblock_ = value.as_bool();
+      else
+        log_print(Runtime, "The value of '{}' must be a bool value.",
+                  key_superblock);
+    }
+    if (object.contains(key_poolsize)) {
+      auto value = object.at(key_poolsize);
+      if (value.is_int64()) {
+        auto ivalue = value.as_int64();
+        if (0 <= ivalue && ivalue <= 256)
+          uc_pool_size_ = ivalue;
+        else
+          log_print(Runtime,
+                    "The value of '{}' must be in the range [0, 256].",
+                    key_poolsize);
+      } else {
+        log_print(Runtime, "The value of '{}' must be an int value.",
+                  key_poolsize);
+      }
+    }
+    if (object.contains(key_poolwarm)) {
+      auto value = object.at(key_poolwarm);
+      if (value.is_int64())
+        uc_pool_warm_ = std::min<int>(value.as_int64(), uc_pool_size_);
+      else
+        log_print(Runtime, "The value of '{}' must be an int value.",
+                  key_poolwarm);
+    }
+    if (object.contains(key_profinterval)) {
+      auto value = object.at(key_profinterval);
+      if (value.is_int64())
+        profile_interval_ = std::max<int>(value.as_int64(), 0);
+      else
+        log_print(Runtime, "The value of '{}' must be an int value.",
+                  key_profinterval);
+    }
+    if (object.contains(key_profoutput)) {
+      auto value = object.at(key_profoutput);
+      if (value.is_string())
+        profile_output_ = value.as_string().c_str();
+      else
+        log_print(Runtime, "The value of '{}' must be a string value.",
+                  key_profoutput);
+    }
+    if (object.contains(key_trace)) {
+      auto value = object.at(key_trace);
+      if (value.is_bool())
+        trace_ = value.as_bool();
+      else
+        log_print(Runtime, "The value of '{}' must be a bool value.",
+                  key_trace);
+    }
+    if (object.contains(key_traceoutput)) {
+      auto value = object.at(key_traceoutput);
+      if (value.is_string())
+        trace_output_ = value.as_string().c_str();
+      else
+        log_print(Runtime, "The value of '{}' must be a string value.",
+                  key_traceoutput);
+    }
+    if (object.contains(key_tracesize)) {
+      auto value = object.at(key_tracesize);
+      if (value.is_int64()) {
+        auto ivalue = value.as_int64();
+        if (1 <= ivalue && ivalue <= 4096)
+          trace_size_ = ivalue * 1024 * 1024;
+        else
+          log_print(Runtime,
+                    "The value of '{}' must be in the range [1, 4096], the "
+                    "internal unit is 1MB.",
+                    key_tracesize);
+      } else {
+        log_print(Runtime, "The value of '{}' must be an int value.",
+                  key_tracesize);
+      }
+    }
+    if (object.contains(key_snippetcache)) {
+      auto value = object.at(key_snippetcache);
+      if (value.is_int64()) {
+        auto ivalue = value.as_int64();
+        if (0 <= ivalue && ivalue <= 1024)
+          snippet_cache_ = ivalue;
+        else
+          log_print(Runtime,
+                    "The value of '{}' must be in the range [0, 1024].",
+                    key_snippetcache);
+      } else {
+        log_print(Runtime, "The value of '{}' must be an int value.",
+                  key_snippetcache);
+      }
+    }
+    if (object.contains(key_snippetdisk)) {
+      auto value = object.at(key_snippetdisk);
+      if (value.is_int64()) {
+        auto ivalue = value.as_int64();
+        if (0 <= ivalue && ivalue <= 4096)
+          snippet_disk_cache_ = ivalue * 1024 * 1024;
+        else
+          log_print(Runtime,
+                    "The value of '{}' must be in the range [0, 4096], the "
+                    "internal unit is 1MB.",
+                    key_snippetdisk);
+      } else {
+        log_print(Runtime, "The value of '{}' must be an int value.",
+                  key_snippetdisk);
+      }
+    }
+    if (object.contains(key_lazydecode)) {
+      auto value = object.at(key_lazydecode);
+      if (value.is_bool())
+        lazy_decode_ = value.as_bool();
+      else
+        log_print(Runtime, "The value of '{}' must be a bool value.",
+                  key_lazydecode);
+    }
 
     log_print(Runtime,
               "Current running configuration = {{\n\tdebugger : {}\n\tstack "
-              "size : {}MB\n\tstep size : {}\n}}",
+              "size : {}MB\n\tstep size : {}\n\tsuperblock : {}\n\tuc pool "
+              ": {}/{}\n\tprofile : {}\n\ttrace : {}\n\tsnippet cache : "
+              "{}/{}MB\n\tlazy decode : {}\n}}",
               has_debugger_ ? "on" : "off", stack_size_ / 1024 / 1024,
               step_size_ <= 0 ? std::string("max")
-                              : std::format("{}", step_size_));
+                              : std::format("{}", step_size_),
+              superblock_ ? "on" : "off", uc_pool_warm_, uc_pool_size_,
+              profile_interval_ ? std::format("{}us -> {}", profile_interval_,
+                                              profile_output_)
+                                : std::string("off"),
+              trace_ ? std::format("{}MB -> {}", trace_size_ / 1024 / 1024,
+                                   trace_output_)
+                     : std::string("off"),
+              snippet_cache_, snippet_disk_cache_ / 1024 / 1024,
+              lazy_decode_ ? "on" : "off");
   } catch (std::exception &e) {
     log_print(Runtime, "Failed to parse the running configuration file: {}.",
               e.what());
@@ -101,4 +242,30 @@ int RunConfig::stepSize() { return step_size_; }
 
 bool RunConfig::hasDebugger() { return has_debugger_; }
 
+bool RunConfig::superblock() {
+  // step debugging needs to stop at each instruction, and the superblock
+  // exits need all the instructions to be decoded
+  return superblock_ && !has_debugger_ && !lazy_decode_;
+}
+
+int RunConfig::ucPoolSize() { return uc_pool_size_; }
+
+int RunConfig::ucPoolWarm() { return uc_pool_warm_; }
+
+int RunConfig::profileInterval() { return profile_interval_; }
+
+const std::string &RunConfig::profileOutput() { return profile_output_; }
+
+bool RunConfig::trace() { return trace_; }
+
+const std::string &RunConfig::traceOutput() { return trace_output_; }
+
+uint64_t RunConfig::traceSize() { return trace_size_; }
+
+int RunConfig::snippetCache() { return snippet_cache_; }
+
+uint64_t RunConfig::snippetDiskCache() { return snippet_disk_cache_; }
+
+bool RunConfig::lazyDecode() { return lazy_decode_; }
+
 } // namespace icpp
@@ -6,6 +6,9 @@
 
 #pragma once
 
+#include <cstdint>
+#include <string>
+
 namespace icpp {
 
 // running config for advanced user from a json configuration file,
@@ -26,6 +29,38 @@ public:
 
   bool hasDebugger();
 
+  // whether let unicorn run across the resolved inner branches
+  bool superblock();
+
+  // the max count of the cached free unicorn instances
+  int ucPoolSize();
+
+  // how many unicorn instances should be created in advance
+  int ucPoolWarm();
+
+  // the sampling interval of the profiler in microseconds, 0 means off
+  int profileInterval();
+
+  // the folded stack file which the profiling result is written to
+  const std::string &profileOutput();
+
+  // whether the execution tracer is on
+  bool trace();
+
+  // the binary trace file and its max size in bytes
+  const std::string &traceOutput();
+  uint64_t traceSize();
+
+  // the max count of the compiled snippet objects kept in memory
+  int snippetCache();
+
+  // the max size in bytes of the snippet .io caches on disk, 0 means off
+  uint64_t snippetDiskCache();
+
+  // whether the functions of the relocatable objects are decoded on their
+  // first execution rather than all at loading
+  bool lazyDecode();
+
   // the main program
   const char *program;
 
@@ -46,6 +81,28 @@ private:
   int step_size_ = -1;
   // default debugger status off
   bool has_debugger_ = false;
+  // default superblock mode off
+  bool superblock_ = false;
+  // default unicorn instance pool size 64
+  int uc_pool_size_ = 64;
+  // default warm unicorn instance count 0
+  int uc_pool_warm_ = 0;
+  // default profiler status off
+  int profile_interval_ = 0;
+  // default profiling result file in the current directory
+  std::string profile_output_ = "icpp-profile.folded";
+  // default tracer status off
+  bool trace_ = false;
+  // default trace file in the current directory
+  std::string trace_output_ = "icpp.trace";
+  // default max trace file size 64MB
+  uint64_t trace_size_ = 64 * 1024 * 1024;
+  // default in memory snippet cache count 32
+  int snippet_cache_ = 32;
+  // default on disk snippet cache off
+  uint64_t snippet_disk_cache_ = 0;
+  // default lazy decoding off
+  bool lazy_decode_ = false;
 };
 
 } // namespace icpp
@@ -11,11 +11,46 @@
 #include "platform.h"
 #include "runcfg.h"
 #include "utils.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/xxhash.h"
+#include <algorithm>
+#include <fstream>
 #include <isymhash.pb.h>
+#include <set>
 
 namespace icpp {
 
+// symbol.index layout: [SymbolIndexHeader, SymbolIndexEntry * capacity,
+// SymbolIndexObject * objcount, '\0' terminated strings], the entries make up
+// an open addressing hash table with linear probing
+constexpr const uint32_t symindex_magic{'xdis'};
+constexpr const uint32_t symindex_version{1};
+constexpr const uint32_t symindex_none{static_cast<uint32_t>(-1)};
+
+struct SymbolIndexHeader {
+  uint32_t magic;    // symindex_magic
+  uint32_t version;  // symindex_version
+  uint32_t capacity; // entry count, it's a power of 2
+  uint32_t objcount; // object/library count
+};
+
+struct SymbolIndexEntry {
+  uint64_t hash;   // 64-bit symbol name hash
+  uint32_t object; // object/library index, symindex_none if it's empty
+  uint32_t name;   // symbol name offset in the strings
+};
+
+struct SymbolIndexObject {
+  uint32_t module; // module name offset in the strings
+  uint32_t path;   // object/library path offset in the strings
+};
+
+static uint64_t symbol_hash64(std::string_view name) {
+  return llvm::xxh3_64bits(llvm::arrayRefFromStringRef(
+      llvm::StringRef(name.data(), name.size())));
+}
+
 RuntimeLib &RuntimeLib::inst() {
   static RuntimeLib rt;
   return rt;
@@ -40,8 +75,16 @@ void RuntimeLib::initHashes() {
   if (hashes_.size())
     return;
 
+  // the modules in symbol.index don't need their hashes any more
+  auto indexed = loadIndex();
   for (auto &entry : fs::directory_iterator(libFull())) {
     if (entry.is_directory()) {
+      auto name = entry.path().filename().string();
+      if (std::find(indexed.begin(), indexed.end(), name) != indexed.end()) {
+        if (fs::exists(entry.path() / hashFile))
+          hashes_.insert({name, nullptr});
+        continue;
+      }
       auto hashfile = entry.path() / hashFile;
       auto expBuff = llvm::MemoryBuffer::getFile(hashfile.string());
       if (!expBuff)
@@ -70,21 +113,246 @@ static constexpr const char *symbol_name(std::string_view raw) {
 #define symbol_name(raw) (raw.data() + 0)
 #endif
 
+static uint32_t symbol_hash(std::string_view symbol) {
+  return static_cast<uint32_t>(
+      std::hash<std::string_view>{}(symbol_name(symbol)));
+}
+
+// the object/library name whose sorted hash array contains hash
+static const std::string *find_hash(const vpimod::SymbolHash &hashes,
+                                    uint32_t hash) {
+  for (auto &lh : hashes.hashes()) {
+    auto hashbuff = reinterpret_cast<const uint32_t *>(lh.second.data());
+    if (std::binary_search(hashbuff,
+                           hashbuff + lh.second.size() / sizeof(hashbuff[0]),
+                           hash)) {
+      return &lh.first;
+    }
+  }
+  return nullptr;
+}
+
 fs::path RuntimeLib::find(std::string_view symbol) {
-  auto hash =
-      static_cast<uint32_t>(std::hash<std::string_view>{}(symbol_name(symbol)));
+  auto path = findIndexed(symbol);
+  if (!path.empty())
+    return path;
+
+  // the modules installed by the older imod aren't in symbol.index
+  auto hash = symbol_hash(symbol);
   // foreach module
   for (auto &mh : hashes_) {
+    if (!mh.second)
+      continue;
     // foreach object/library
-    for (auto lh : mh.second->hashes()) {
-      auto hashbuff = reinterpret_cast<const uint32_t *>(&lh.second[0]);
-      if (std::binary_search(hashbuff,
-                             hashbuff + lh.second.size() / sizeof(hashbuff[0]),
-                             hash)) {
-        return libFull(mh.first) / lh.first;
+    if (auto name = find_hash(*mh.second, hash))
+      return libFull(mh.first) / *name;
+  }
+  return "";
+}
+
+std::vector<std::string_view> RuntimeLib::loadIndex() {
+  std::vector<std::string_view> modules;
+  auto indexfile = (libFull() / indexFile).string();
+  auto expBuff = llvm::MemoryBuffer::getFile(indexfile);
+  if (!expBuff)
+    return modules;
+
+  auto buff = expBuff.get()->getBuffer();
+  auto header = reinterpret_cast<const SymbolIndexHeader *>(buff.data());
+  auto fixedsize = [header]() {
+    return sizeof(SymbolIndexHeader) +
+           sizeof(SymbolIndexEntry) * static_cast<uint64_t>(header->capacity) +
+           sizeof(SymbolIndexObject) * static_cast<uint64_t>(header->objcount);
+  };
+  if (buff.size() < sizeof(SymbolIndexHeader) ||
+      header->magic != symindex_magic || header->version != symindex_version ||
+      !header->capacity || (header->capacity & (header->capacity - 1)) ||
+      buff.size() < fixedsize()) {
+    log_print(Runtime, "Ignored the incompatible or corrupted {}.", indexfile);
+    return modules;
+  }
+  auto strings = buff.substr(fixedsize());
+  if (strings.size() && strings.back() != '\0') {
+    log_print(Runtime, "Ignored the corrupted {}.", indexfile);
+    return modules;
+  }
+  auto objects = reinterpret_cast<const SymbolIndexObject *>(
+      buff.data() + sizeof(SymbolIndexHeader) +
+      sizeof(SymbolIndexEntry) * header->capacity);
+  for (uint32_t i = 0; i < header->objcount; i++) {
+    if (objects[i].module >= strings.size() ||
+        objects[i].path >= strings.size()) {
+      log_print(Runtime, "Ignored the corrupted {}.", indexfile);
+      return {};
+    }
+  }
+  index_ = std::move(expBuff.get());
+  for (uint32_t i = 0; i < header->objcount; i++) {
+    std::string_view module{strings.data() + objects[i].module};
+    if (std::find(modules.begin(), modules.end(), module) == modules.end())
+      modules.push_back(module);
+  }
+  log_print(Develop, "Loaded symbol index {} of {} modules.", indexfile,
+            modules.size());
+  return modules;
+}
+
+fs::path RuntimeLib::findIndexed(std::string_view symbol) {
+  if (!index_)
+    return "";
+
+  auto buff = index_->getBuffer();
+  auto header = reinterpret_cast<const SymbolIndexHeader *>(buff.data());
+  auto entries = reinterpret_cast<const SymbolIndexEntry *>(header + 1);
+  auto objects =
+      reinterpret_cast<const SymbolIndexObject *>(entries + header->capacity);
+  auto strings = reinterpret_cast<const char *>(objects + header->objcount);
+  auto strsize = static_cast<size_t>(buff.end() - strings);
+
+  std::string_view name{symbol_name(symbol)};
+  auto hash = symbol_hash64(name);
+  auto mask = header->capacity - 1;
+  for (uint32_t i = hash & mask, n = 0; n < header->capacity;
+       i = (i + 1) & mask, n++) {
+    auto &e = entries[i];
+    if (e.object == symindex_none)
+      break;
+    if (e.hash != hash || e.object >= header->objcount || e.name >= strsize ||
+        name != strings + e.name)
+      continue;
+    auto &o = objects[e.object];
+    return libFull(strings + o.module) / (strings + o.path);
+  }
+  return "";
+}
+
+bool RuntimeLib::buildIndex(std::string &message) {
+  std::vector<SymbolIndexObject> objects;
+  std::string strings;
+  auto addstr = [&strings](std::string_view str) {
+    auto offset = static_cast<uint32_t>(strings.size());
+    strings.append(str);
+    strings.push_back('\0');
+    return offset;
+  };
+  // <symbol name offset, object index>
+  std::vector<std::pair<uint32_t, uint32_t>> symbols;
+
+  // sorted as the module order of the previous lookup
+  std::set<fs::path> moddirs;
+  for (auto &entry : fs::directory_iterator(libFull())) {
+    if (entry.is_directory() && fs::exists(entry.path() / hashFile))
+      moddirs.insert(entry.path());
+  }
+  for (auto &dir : moddirs) {
+    auto hashfile = dir / hashFile;
+    auto expBuff = llvm::MemoryBuffer::getFile(hashfile.string());
+    vpimod::SymbolHash symhash;
+    if (!expBuff || !symhash.ParseFromArray(expBuff.get()->getBufferStart(),
+                                            expBuff.get()->getBufferSize())) {
+      message = std::format("Failed to parse {}.", hashfile.string());
+      return false;
+    }
+    auto module = addstr(dir.filename().string());
+    std::map<std::string_view, std::string_view> names;
+    for (auto &ln : symhash.names())
+      names.insert({ln.first, ln.second});
+    for (auto &ln : names) {
+      auto object = static_cast<uint32_t>(objects.size());
+      objects.push_back(SymbolIndexObject{module, addstr(ln.first)});
+      for (auto list = ln.second; list.size();) {
+        auto end = list.find('\0');
+        symbols.push_back({addstr(list.substr(0, end)), object});
+        list = end == std::string_view::npos ? "" : list.substr(end + 1);
+      }
+    }
+  }
+
+  // keep the load factor at most 50%
+  uint32_t capacity = 16;
+  while (capacity < symbols.size() * 2)
+    capacity <<= 1;
+  std::string index(sizeof(SymbolIndexHeader) +
+                        sizeof(SymbolIndexEntry) * capacity,
+                    0);
+  auto header = reinterpret_cast<SymbolIndexHeader *>(&index[0]);
+  header->magic = symindex_magic;
+  header->version = symindex_version;
+  header->capacity = capacity;
+  header->objcount = static_cast<uint32_t>(objects.size());
+  auto entries = reinterpret_cast<SymbolIndexEntry *>(header + 1);
+  for (uint32_t i = 0; i < capacity; i++)
+    entries[i].object = symindex_none;
+  for (auto &[name, object] : symbols) {
+    std::string_view symbol{&strings[name]};
+    auto hash = symbol_hash64(symbol);
+    for (auto i = hash & (capacity - 1);; i = (i + 1) & (capacity - 1)) {
+      auto &e = entries[i];
+      if (e.object == symindex_none) {
+        e = SymbolIndexEntry{hash, object, name};
+        break;
       }
+      // keep the first one if it's defined in several objects
+      if (e.hash == hash && symbol == &strings[e.name])
+        break;
     }
   }
+  index.append(reinterpret_cast<const char *>(objects.data()),
+               sizeof(SymbolIndexObject) * objects.size());
+  index.append(strings);
+
+  // replace the old one which may be mapped by some running icpp instance
+  auto indexfile = libFull() / indexFile;
+  auto tmpfile = indexfile.string() + rand_filename(8, ".tmp");
+  std::ofstream outf(tmpfile, std::ios::binary);
+  if (!outf.is_open()) {
+    message = std::format("Failed to create {}.", tmpfile);
+    return false;
+  }
+  outf.write(index.data(), index.size());
+  outf.close();
+  std::error_code err;
+  fs::rename(tmpfile, indexfile, err);
+  if (err) {
+    fs::remove(tmpfile, err);
+    message = std::format("Failed to create {}.", indexfile.string());
+    return false;
+  }
+  message = std::format("Indexed {} symbols of {} modules in {}.",
+                        symbols.size(), moddirs.size(), indexfile.string());
+  return true;
+}
+
+fs::path RuntimeLib::boostFull() {
+  return fs::absolute(RunConfig::inst()->program).parent_path() / ".." /
+         libRelative() / "boost";
+}
+
+bool RuntimeLib::boostIndexed() {
+  if (!boosthashes_) {
+    boosthashes_ = std::make_unique<vpimod::SymbolHash>();
+    auto hashfile = boostFull() / hashFile;
+    auto expBuff = llvm::MemoryBuffer::getFile(hashfile.string());
+    if (!expBuff) {
+      log_print(Develop, "There's no boost symbol index {}.",
+                hashfile.string());
+    } else if (!boosthashes_->ParseFromArray(
+                   expBuff.get()->getBufferStart(),
+                   expBuff.get()->getBufferSize())) {
+      log_print(Runtime, "Failed to parse {}.", hashfile.string());
+      boosthashes_->Clear();
+    } else {
+      log_print(Develop, "Loaded boost symbol index {}.", hashfile.string());
+    }
+  }
+  return boosthashes_->hashes_size();
+}
+
+fs::path RuntimeLib::findBoost(std::string_view symbol) {
+  if (!boostIndexed())
+    return "";
+  if (auto name = find_hash(*boosthashes_, symbol_hash(symbol)))
+    return boostFull() / *name;
   return "";
 }
 
@@ -21,6 +21,10 @@ class SymbolHash;
 
 namespace vpimod = com::vpand::imod;
 
+namespace llvm {
+class MemoryBuffer;
+}
+
 namespace icpp {
 
 // third-part module extension for icpp runtime, usually it's installed
@@ -80,18 +84,50 @@ public:
   */
   fs::path find(std::string_view symbol);
 
+  /*
+  Merge the symbol names of all the installed modules into a single
+  symbol.index, it's a memory mapped hash table from the 64-bit symbol hash
+  to its module and object/library, the full symbol name is verified when
+  finding. It's called by imod after installing/uninstalling modules.
+  */
+  bool buildIndex(std::string &message);
+
+  // the bundled boost libraries directory of the icpp package
+  fs::path boostFull();
+
+  /*
+  The bundled boost libraries are loaded on demand with the prebuilt symbol
+  index generated by tool-icpp/release.cc, the return value is the library
+  full path that may contain this symbol, empty if there's no such one or
+  the index is unavailable.
+  */
+  fs::path findBoost(std::string_view symbol);
+
+  // whether the symbol index of the bundled boost libraries is available
+  bool boostIndexed();
+
   std::vector<std::string_view> modules();
 
   const std::string_view repoName{".icpp"};
   const std::string_view hashFile{"symbol.hash"};
+  const std::string_view indexFile{"symbol.index"};
   const std::string_view packageExtension{".icpp"};
 
 private:
   RuntimeLib();
   ~RuntimeLib();
 
-  // <module name, hashes>
+  // load symbol.index and return the module names it contains
+  std::vector<std::string_view> loadIndex();
+  // find the symbol in symbol.index, return empty if it's missing
+  fs::path findIndexed(std::string_view symbol);
+
+  // <module name, hashes>, the hashes are nullptr if it's in symbol.index
   std::map<std::string, std::unique_ptr<vpimod::SymbolHash>> hashes_;
+  // the merged symbol index of the installed modules
+  std::unique_ptr<llvm::MemoryBuffer> index_;
+  // <boost library relative path, hashes>, loaded at the first boost symbol
+  std::unique_ptr<vpimod::SymbolHash> boosthashes_;
 };
 
 namespace api {
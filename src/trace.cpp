@@ -5,5 +5,256 @@
 */
 
 #include "trace.h"
+#include "object.h"
+#include "runcfg.h"
+#include "utils.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Process.h>
 
-namespace icpp {}
+namespace icpp {
+
+static uint64_t trace_now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+Tracer *Tracer::inst() {
+  static std::unique_ptr<Tracer> tracer = []() {
+    auto runcfg = RunConfig::inst();
+    return runcfg->trace()
+               ? std::make_unique<Tracer>(runcfg->traceOutput(),
+                                          runcfg->traceSize())
+               : nullptr;
+  }();
+  return tracer.get();
+}
+
+Tracer::Tracer(std::string_view output, uint64_t size)
+    : output_(output), start_(trace_now()) {
+  namespace sfs = llvm::sys::fs;
+  auto err = sfs::openFileForReadWrite(output_, fd_, sfs::CD_CreateAlways,
+                                       sfs::OF_None);
+  if (!err)
+    err = sfs::resize_file(fd_, size);
+  if (!err) {
+    region_ = std::make_unique<sfs::mapped_file_region>(
+        sfs::convertFDToNativeFile(fd_), sfs::mapped_file_region::readwrite,
+        size, 0, err);
+  }
+  if (err) {
+    log_print(Runtime, "Failed to create the trace file '{}': {}.", output_,
+              err.message());
+    region_.reset();
+    return;
+  }
+
+  header_ = reinterpret_cast<TraceHeader *>(region_->data());
+  std::memset(header_, 0, sizeof(*header_));
+  std::memcpy(header_->magic, trace_magic.data(), trace_magic.size());
+  header_->version = trace_version;
+  records_ = reinterpret_cast<TraceRecord *>(header_ + 1);
+  capacity_ = (size - sizeof(*header_)) / sizeof(TraceRecord);
+
+  flusher_ = std::thread([this]() {
+    while (!stop_.load(std::memory_order_relaxed)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      flush();
+    }
+  });
+}
+
+Tracer::~Tracer() {
+  if (!header_) {
+    if (fd_ >= 0)
+      llvm::sys::Process::SafelyCloseFileDescriptor(fd_);
+    return;
+  }
+
+  stop_ = true;
+  flusher_.join();
+  flush();
+
+  auto count = header_->reccount;
+  auto dropped = header_->dropped;
+  region_.reset();
+  // truncate the unused record space
+  llvm::sys::fs::resize_file(fd_, sizeof(TraceHeader) +
+                                      count * sizeof(TraceRecord));
+  llvm::sys::Process::SafelyCloseFileDescriptor(fd_);
+  log_print(Runtime, "Wrote {} trace records to '{}', {} dropped.", count,
+            output_, dropped);
+}
+
+Tracer::Ring *Tracer::threadRing() {
+  thread_local Ring *ring = nullptr;
+  if (!ring) {
+    std::lock_guard lock(mutex_);
+    rings_.push_back(std::make_unique<Ring>());
+    ring = rings_.back().get();
+    ring->index = rings_.size() - 1;
+  }
+  return ring;
+}
+
+uint16_t Tracer::moduleIndex(Object *object) {
+  std::lock_guard lock(mutex_);
+  for (size_t i = 0; i < modules_.size(); i++) {
+    if (modules_[i] == object)
+      return i;
+  }
+  if (modules_.size() == trace_max_modules)
+    return trace_host_module;
+  auto path = object->path();
+  auto &slot = header_->modules[modules_.size()];
+  std::memcpy(slot, path.data(), std::min<size_t>(path.size(),
+                                                  trace_path_size - 1));
+  modules_.push_back(object);
+  header_->modcount = modules_.size();
+  return modules_.size() - 1;
+}
+
+void Tracer::record(TraceKind kind, Object *object, uint64_t addr) {
+  if (!header_)
+    return;
+
+  auto ring = threadRing();
+  auto head = ring->head.load(std::memory_order_relaxed);
+  if (head - ring->tail.load(std::memory_order_acquire) == ring_size) {
+    ring->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  auto &rec = ring->records[head % ring_size];
+  rec.time = trace_now() - start_;
+  rec.kind = kind;
+  rec.thread = ring->index;
+  rec.module = trace_host_module;
+  rec.addr = addr;
+  if (object) {
+    auto vrva = object->vm2vrva(addr);
+    if (vrva != static_cast<uint64_t>(-1)) {
+      if (object != ring->lastobj) {
+        ring->lastmod = moduleIndex(object);
+        ring->lastobj = object;
+      }
+      if (ring->lastmod != trace_host_module) {
+        rec.module = ring->lastmod;
+        rec.addr = vrva;
+      }
+    }
+  }
+  ring->head.store(head + 1, std::memory_order_release);
+}
+
+void Tracer::flush() {
+  if (!header_)
+    return;
+
+  std::lock_guard flock(flushmutex_);
+  std::vector<Ring *> rings;
+  {
+    std::lock_guard lock(mutex_);
+    for (auto &r : rings_)
+      rings.push_back(r.get());
+  }
+  auto count = header_->reccount;
+  uint64_t dropped = 0;
+  for (auto r : rings) {
+    auto tail = r->tail.load(std::memory_order_relaxed);
+    auto head = r->head.load(std::memory_order_acquire);
+    for (; tail != head; tail++) {
+      if (count == capacity_) {
+        dropped++;
+        continue;
+      }
+      records_[count++] = r->records[tail % ring_size];
+    }
+    r->tail.store(tail, std::memory_order_release);
+    dropped += r->dropped.exchange(0, std::memory_order_relaxed);
+  }
+  header_->reccount = count;
+  header_->dropped += dropped;
+}
+
+static std::string_view trace_kind_name(uint16_t kind) {
+  switch (kind) {
+  case TRACE_BLOCK:
+    return "block";
+  case TRACE_CALL:
+    return "call";
+  case TRACE_RETURN:
+    return "return";
+  case TRACE_EXCEPTION:
+    return "exception";
+  default:
+    return "unknown";
+  }
+}
+
+int trace_decode(std::string_view path) {
+  auto expBuff = llvm::MemoryBuffer::getFile(path);
+  if (!expBuff) {
+    log_print(Runtime, "Failed to read '{}': {}.", path,
+              expBuff.getError().message());
+    return -1;
+  }
+  auto buff = expBuff.get()->getBuffer();
+  auto header = reinterpret_cast<const TraceHeader *>(buff.data());
+  if (buff.size() < sizeof(TraceHeader) ||
+      trace_magic != std::string_view(header->magic) ||
+      header->version != trace_version) {
+    log_print(Runtime, "Invalid or unsupported trace file '{}'.", path);
+    return -1;
+  }
+  auto count = std::min<uint64_t>(header->reccount,
+                                  (buff.size() - sizeof(TraceHeader)) /
+                                      sizeof(TraceRecord));
+  auto records = reinterpret_cast<const TraceRecord *>(header + 1);
+
+  // reload the traced modules for symbolization
+  std::vector<std::shared_ptr<Object>> modules(header->modcount);
+  for (uint32_t i = 0; i < header->modcount; i++) {
+    std::string_view mpath{header->modules[i]};
+    log_print(Raw, "module[{}] {}", i, mpath);
+    bool validcache;
+    if (fs::exists(mpath))
+      modules[i] = create_object("", mpath, validcache);
+    if (!modules[i] || !modules[i]->valid()) {
+      modules[i].reset();
+      log_print(Raw, "  unavailable, only the raw addresses are printed.");
+    }
+  }
+  log_print(Raw, "{} records, {} dropped.", header->reccount, header->dropped);
+
+  for (uint64_t i = 0; i < count; i++) {
+    auto &rec = records[i];
+    std::string where;
+    std::string source;
+    if (rec.module == trace_host_module) {
+      where = std::format("host!{:x}", rec.addr);
+    } else {
+      where = std::format("module[{}]!{:x}", rec.module, rec.addr);
+      auto object =
+          rec.module < modules.size() ? modules[rec.module].get() : nullptr;
+      if (object) {
+        auto vm = object->vrva2vm(rec.addr);
+        auto name = object->functionName(vm);
+        if (name.size())
+          where += std::format(" {}", name);
+        source = object->sourceInfo(vm);
+      }
+    }
+    log_print(Raw, "[{}] {:>14.3f}us {:<9} {}", rec.thread, rec.time / 1000.0,
+              trace_kind_name(rec.kind), where);
+    if (source.size())
+      std::cout << source;
+  }
+  return 0;
+}
+
+} // namespace icpp
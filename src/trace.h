@@ -6,4 +6,113 @@
 
 #pragma once
 
-namespace icpp {}
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace llvm::sys::fs {
+class mapped_file_region;
+}
+
+namespace icpp {
+
+class Object;
+
+enum TraceKind : uint16_t {
+  TRACE_BLOCK,     // unicorn starts running at addr
+  TRACE_CALL,      // call to addr
+  TRACE_RETURN,    // host call returns to addr
+  TRACE_EXCEPTION, // exception or fatal error raised at addr
+};
+
+// module index of the host address
+constexpr const uint16_t trace_host_module = 0xffff;
+constexpr const uint32_t trace_max_modules = 256;
+constexpr const uint32_t trace_path_size = 256;
+constexpr const uint32_t trace_version = 1;
+constexpr const std::string_view trace_magic{"ICPPTRC"};
+
+// a fixed size trace record, addr is the vrva in module or the absolute
+// address of the host function
+struct TraceRecord {
+  uint64_t time; // nanoseconds since tracing started
+  uint64_t addr;
+  uint16_t kind;
+  uint16_t module;
+  uint32_t thread;
+};
+static_assert(sizeof(TraceRecord) == 24);
+
+// trace file layout: [TraceHeader, TraceRecord...]
+struct TraceHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t modcount;
+  uint64_t reccount;
+  uint64_t dropped;
+  char modules[trace_max_modules][trace_path_size];
+};
+
+/*
+execution tracer, it's enabled by the "vm_trace" of the running
+configuration.
+
+each thread appends its records to its own lock-free ring buffer, the
+flusher thread drains them to the memory mapped trace file in background,
+the records are dropped rather than blocking the interpreter if a ring is
+full.
+*/
+class Tracer {
+public:
+  // the tracer instance, nullptr if tracing is off
+  static Tracer *inst();
+
+  Tracer(std::string_view output, uint64_t size);
+  ~Tracer();
+
+  void record(TraceKind kind, Object *object, uint64_t addr);
+
+  // drain all the ring buffers to the trace file
+  void flush();
+
+private:
+  static constexpr uint32_t ring_size = 4096;
+
+  struct Ring {
+    uint32_t index;
+    Object *lastobj = nullptr;
+    uint16_t lastmod = trace_host_module;
+    std::atomic<uint64_t> head{0}, tail{0}, dropped{0};
+    TraceRecord records[ring_size];
+  };
+  Ring *threadRing();
+  uint16_t moduleIndex(Object *object);
+
+  std::unique_ptr<llvm::sys::fs::mapped_file_region> region_;
+  int fd_ = -1;
+  std::string output_;
+  TraceHeader *header_ = nullptr;
+  TraceRecord *records_ = nullptr;
+  uint64_t capacity_ = 0;
+  uint64_t start_;
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<Ring>> rings_;
+  std::vector<Object *> modules_;
+
+  // serialize the flushers
+  std::mutex flushmutex_;
+  std::atomic<bool> stop_{false};
+  std::thread flusher_;
+};
+
+// print the records of a trace file with the source information of
+// the modules it refers to
+int trace_decode(std::string_view path);
+
+} // namespace icpp
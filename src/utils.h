@@ -7,9 +7,12 @@
 #pragma once
 
 #include "log.h"
+#include <cstdint>
+#include <cstring>
 #include <filesystem>
 #include <functional>
 #include <mutex>
+#include <string>
 #include <string_view>
 
 namespace fs = std::filesystem;
@@ -36,6 +39,47 @@ struct ProtocolHdr {
       len : 24;          // protobuf length
 };
 
+// ProtocolHdr::len of the frame whose body is too large to be encoded in it,
+// the real body length follows the header as a uint64_t
+constexpr const std::uint32_t protocol_len_extended = 0xffffff;
+
+// encode a protocol frame: [ProtocolHdr, extended length if any, body]
+inline std::string protocol_frame(std::uint32_t cmd, std::string_view body) {
+  bool extended = body.length() >= protocol_len_extended;
+  std::string buff(sizeof(ProtocolHdr), 0);
+  auto hdr = reinterpret_cast<ProtocolHdr *>(buff.data());
+  hdr->cmd = cmd;
+  hdr->len = extended ? protocol_len_extended
+                      : static_cast<std::uint32_t>(body.length());
+  if (extended) {
+    std::uint64_t len = body.length();
+    buff.append(reinterpret_cast<const char *>(&len), sizeof(len));
+  }
+  buff.append(body);
+  return buff;
+}
+
+// the maximum body size of a received protocol frame, i.e.: the largest
+// object of a RUN command plus the command fields around it
+constexpr const std::uint64_t protocol_body_limit = (1ULL << 30) + 1024 * 1024;
+
+// the length is sent by the peer, refuse it rather than allocating blindly
+inline bool protocol_body_valid(std::uint64_t len) {
+  return len <= protocol_body_limit;
+}
+
+// decode the body length of a received frame, read(void *buff, size_t size)
+// reads the extended length following hdr and returns false if it failed,
+// false is also returned if the length exceeds protocol_body_limit
+template <typename Reader>
+bool protocol_body_length(const ProtocolHdr *hdr, Reader &&read,
+                          std::uint64_t &len) {
+  len = hdr->len;
+  if (len == protocol_len_extended && !read(&len, sizeof(len)))
+    return false;
+  return protocol_body_valid(len);
+}
+
 enum IterateState {
   IterContinue,
   IterBreak,
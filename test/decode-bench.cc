@@ -0,0 +1,73 @@
+/*
+Decoding benchmark of a large synthetic object.
+
+It generates a source with tons of functions and distinct relocation targets,
+compiles it once to an object file, then loads a fresh copy of that object
+without its .io cache several times. So each round only parses, decodes and
+relocates the object, neither compiling nor running it. Run it with a debug
+build of icpp to see the "Decoded ... in ...ms" log of decodeInsns itself.
+
+Usage: icpp decode-bench.cc [function count] [round count]
+*/
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <icpp.hpp>
+
+int main(int argc, const char *argv[]) {
+  int count = argc > 1 ? std::atoi(argv[1]) : 10000;
+  int rounds = argc > 2 ? std::atoi(argv[2]) : 3;
+  auto dir = fs::temp_directory_path() / "icpp-decode-bench";
+  fs::create_directories(dir);
+  auto srcpath = dir / "synthetic.cc";
+  {
+    std::ofstream src(srcpath);
+    src << "#include <cstdio>\n";
+    for (int i = 0; i < count; i++)
+      src << std::format("int g{0} = {0};\n", i);
+    // each function references some globals and its previous function, so
+    // there are about 5 relocations per function
+    for (int i = 0; i < count; i++) {
+      src << std::format("__attribute__((noinline)) int f{}(int x) {{\n"
+                         "  return x",
+                         i);
+      for (int j = 1; j <= 4; j++)
+        src << std::format(" + g{}", (i + j * 7) % count);
+      if (i)
+        src << std::format(" + (x > 0 ? f{}(x - 1) : 0)", i - 1);
+      src << ";\n}\n";
+    }
+    src << "int main() {\n  std::printf(\"f0(1) = %d\\n\", f0(1));\n"
+           "  return 0;\n}\n";
+  }
+  icpp::prints("Generated {} with {} functions.\n", srcpath.string(), count);
+
+  // compile it only once, the rounds below load the prebuilt object
+  auto opath = dir / "synthetic.o";
+  auto cmd = std::format("\"{}\" -c \"{}\" -o \"{}\"", icpp::program(),
+                         srcpath.string(), opath.string());
+  if (std::system(cmd.c_str()) || !fs::exists(opath)) {
+    icpp::prints("Failed to compile {}.\n", srcpath.string());
+    return -1;
+  }
+
+  for (int i = 0; i < rounds; i++) {
+    // a loaded object is kept by its path, decode a new copy of it each round
+    auto rpath = dir / std::format("synthetic-{}.o", i);
+    fs::copy_file(opath, rpath, fs::copy_options::overwrite_existing);
+    fs::remove(fs::path(rpath).replace_extension(".io"));
+    auto start = std::chrono::steady_clock::now();
+    auto handle = icpp::load_library(rpath.string());
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+    if (!handle) {
+      icpp::prints("Failed to load {}.\n", rpath.string());
+      return -1;
+    }
+    icpp::prints("Round {}: parsed, decoded and relocated in {}ms.\n", i,
+                 elapsed);
+  }
+  return 0;
+}
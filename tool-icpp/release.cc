@@ -264,6 +264,15 @@ int main(int argc, char **argv) {
     create_dir(lib / "boost");
     pack_dir(boostinc / "boost", include);
     pack_dir(boostlib / ".", lib, "boost");
+
+    // create the symbol index of the boost libraries, icpp loads the one
+    // which defines the symbol on demand rather than all of them
+    auto imod = srcroot / ("imod" EXEEXT);
+    if (std::system(std::format("{} --hash={}", imod.string(),
+                                (lib / "boost").string())
+                        .data()))
+      log(std::format("Failed to create the symbol index of {}.",
+                      (lib / "boost").string()));
   } else {
     log(std::format("Can't find boost in {}, skipped packing boost.",
                     boost.string()));
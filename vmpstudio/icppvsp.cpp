@@ -147,9 +147,18 @@ void vsp_icpp_t::recv() {
     if (!hdr->len) {
       continue;
     }
+    uint64_t bodylen = hdr->len;
+    if (bodylen == icpp::protocol_len_extended) {
+      // the body is too large to encode its length in the header
+      asio::read(socket_, asio::buffer(&bodylen, sizeof(bodylen)), error);
+      if (error) {
+        log_print("Failed to read body length: {}.\n", error.message());
+        break;
+      }
+    }
     // protocol body serialized by protobuf
     asio::streambuf probuffer;
-    asio::read(socket_, probuffer, asio::transfer_exactly(hdr->len), error);
+    asio::read(socket_, probuffer, asio::transfer_exactly(bodylen), error);
     if (error && error != asio::error::eof) {
       log_print("Failed to read body buffer: {}.\n", error.message());
       continue;
@@ -195,12 +204,7 @@ void vsp_icpp_t::send(icppdbg::CommandID id, const std::string &cmd) {
     return;
   }
 
-  std::string buff;
-  buff.resize(sizeof(icpp::ProtocolHdr) + cmd.length());
-  auto hdr = reinterpret_cast<icpp::ProtocolHdr *>(buff.data());
-  hdr->cmd = id;
-  hdr->len = static_cast<uint32_t>(cmd.length());
-  std::memcpy(&hdr[1], cmd.data(), cmd.length());
+  auto buff = icpp::protocol_frame(id, cmd);
 
   boost::system::error_code error;
   asio::write(socket_, asio::buffer(buff), error);